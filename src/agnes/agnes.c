@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <debug.h>
 #ifndef AGNES_SINGLE_HEADER
 #include "agnes.h"
@@ -9,6 +10,11 @@
 #include "agnes_types.h"
 #include "cpu.h"
 #include "ppu.h"
+#include "scheduler.h"
+#include "instructions.h"
+#include "block_cache.h"
+#include "chr_cache.h"
+#include "framebuffer.h"
 
 #include "mapper.h"
 #endif
@@ -57,6 +63,23 @@ agnes_t* agnes_make(void) {
     }
     memset(agnes, 0, sizeof(*agnes));
     memset(agnes->ram, 0xff, sizeof(agnes->ram));
+#if AGNES_BLOCK_CACHE
+    agnes->block_cache = block_cache_make();
+    if (!agnes->block_cache) {
+        free(agnes);
+        return NULL;
+    }
+#endif
+#if AGNES_CHR_CACHE
+    agnes->chr_cache = chr_cache_make();
+    if (!agnes->chr_cache) {
+#if AGNES_BLOCK_CACHE
+        block_cache_destroy(agnes->block_cache);
+#endif
+        free(agnes);
+        return NULL;
+    }
+#endif
     return agnes;
 }
 
@@ -94,6 +117,12 @@ bool agnes_load_ines_data(agnes_t *agnes, void *data, size_t data_size) {
     agnes->gamepack.prg_rom_offset = prg_rom_offset;
     agnes->gamepack.chr_rom_offset = chr_rom_offset;
 
+#if AGNES_BLOCK_CACHE
+    block_cache_flush(agnes->block_cache);
+#endif
+#if AGNES_CHR_CACHE
+    chr_cache_flush(agnes->chr_cache);
+#endif
     bool ok = mapper_init(agnes);
     if (!ok) {
         return false;
@@ -101,6 +130,8 @@ bool agnes_load_ines_data(agnes_t *agnes, void *data, size_t data_size) {
 
     cpu_init(&agnes->cpu, agnes);
     ppu_init(&agnes->ppu, agnes);
+    scheduler_reset(&agnes->scheduler);
+    framebuffer_write_screen(&agnes->framebuffer, agnes->ppu.screen_buffer);
     
     return true;
 }
@@ -122,6 +153,22 @@ void agnes_dump_state(const agnes_t *agnes, agnes_state_t *out_res) {
     memmove(out_res, agnes, sizeof(agnes_t));
     out_res->agnes.gamepack.data = NULL;
     out_res->agnes.cpu.agnes = NULL;
+    memset(&out_res->agnes.framebuffer, 0, sizeof(out_res->agnes.framebuffer));
+#if AGNES_BLOCK_CACHE
+    out_res->agnes.block_cache = NULL;
+#endif
+#if AGNES_CHR_CACHE
+    out_res->agnes.chr_cache = NULL;
+#endif
+    memset(out_res->agnes.cpu.read_pages, 0, sizeof(out_res->agnes.cpu.read_pages));
+    memset(out_res->agnes.cpu.write_pages, 0, sizeof(out_res->agnes.cpu.write_pages));
+    memset(out_res->agnes.ppu.pages, 0, sizeof(out_res->agnes.ppu.pages));
+#if AGNES_LAZY_FLAGS
+    // States always hold the flags as 0/1
+    out_res->agnes.cpu.flag_zero = CPU_FLAG_Z(&agnes->cpu);
+    out_res->agnes.cpu.flag_negative = CPU_FLAG_N(&agnes->cpu);
+    out_res->agnes.cpu.flag_overflow = CPU_FLAG_V(&agnes->cpu);
+#endif
     out_res->agnes.ppu.agnes = NULL;
     switch (out_res->agnes.gamepack.mapper) {
         case 0: out_res->agnes.mapper.m0.agnes = NULL; break;
@@ -133,8 +180,23 @@ void agnes_dump_state(const agnes_t *agnes, agnes_state_t *out_res) {
 
 bool agnes_restore_state(agnes_t *agnes, const agnes_state_t *state) {
     const uint8_t *gamepack_data = agnes->gamepack.data;
+#if AGNES_BLOCK_CACHE
+    struct block_cache *block_cache = agnes->block_cache; // still valid, same PRG ROM
+#endif
+#if AGNES_CHR_CACHE
+    struct chr_cache *chr_cache = agnes->chr_cache;
+#endif
+    framebuffer_t framebuffer = agnes->framebuffer;
     memmove(agnes, state, sizeof(agnes_t));
     agnes->gamepack.data = gamepack_data;
+    agnes->framebuffer = framebuffer;
+#if AGNES_BLOCK_CACHE
+    agnes->block_cache = block_cache;
+#endif
+#if AGNES_CHR_CACHE
+    agnes->chr_cache = chr_cache;
+    chr_cache_flush(chr_cache); // CHR RAM and banks came with the state
+#endif
     agnes->cpu.agnes = agnes;
     agnes->ppu.agnes = agnes;
     switch (agnes->gamepack.mapper) {
@@ -143,6 +205,15 @@ bool agnes_restore_state(agnes_t *agnes, const agnes_state_t *state) {
         case 2: agnes->mapper.m2.agnes = agnes; break;
         case 4: agnes->mapper.m4.agnes = agnes; break;
     }
+#if AGNES_LAZY_FLAGS
+    CPU_SET_Z_FROM(&agnes->cpu, !agnes->cpu.flag_zero);
+    CPU_SET_N_FROM(&agnes->cpu, agnes->cpu.flag_negative << 7);
+    CPU_SET_V_FROM(&agnes->cpu, agnes->cpu.flag_overflow << 7);
+#endif
+    cpu_update_pages(&agnes->cpu);
+    ppu_update_pages(&agnes->ppu);
+    memset(agnes->ppu.dirty_lines, 0xff, sizeof(agnes->ppu.dirty_lines)); // the frontend shows another screen
+    framebuffer_write_screen(&agnes->framebuffer, agnes->ppu.screen_buffer);
     return true;
 }
 
@@ -152,15 +223,15 @@ bool agnes_tick(agnes_t *agnes, bool *out_new_frame) {
         return false;
     }
 
-    int ppu_cycles = cpu_cycles * 3;
-    for (int i = 0; i < ppu_cycles; i++) {
-        ppu_tick(&agnes->ppu, out_new_frame);
-    }
-    
+    ppu_run(&agnes->ppu, cpu_cycles, out_new_frame);
+
     return true;
 }
 
 bool agnes_next_frame(agnes_t *agnes) {
+#if AGNES_DISPATCH != AGNES_DISPATCH_TICK
+    return instruction_run(&agnes->cpu, INT_MAX, true) >= 0;
+#else
     while (true) {
         bool new_frame = false;
         bool ok = agnes_tick(agnes, &new_frame);
@@ -172,6 +243,33 @@ bool agnes_next_frame(agnes_t *agnes) {
         }
     }
     return true;
+#endif
+}
+
+// agnes_next_frame() without drawing into the screen buffer, which keeps the
+// last drawn frame. Everything the game can see runs the same, sprite 0 hits
+// included, so a frontend can show only every Nth frame.
+bool agnes_next_frame_skip(agnes_t *agnes) {
+    agnes->ppu.skip_render = true;
+    bool ok = agnes_next_frame(agnes);
+    agnes->ppu.skip_render = false;
+    return ok;
+}
+
+// Runs the emulation for the given number of CPU cycles. Instructions aren't
+// split, so a run can end a few cycles late; that's taken off the next budget.
+bool agnes_run_cycles(agnes_t *agnes, int cycles) {
+    int budget = cycles - agnes->cycles_overrun;
+    if (budget <= 0) {
+        agnes->cycles_overrun = -budget;
+        return true;
+    }
+    int cycles_run = instruction_run(&agnes->cpu, budget, false);
+    if (cycles_run < 0) {
+        return false;
+    }
+    agnes->cycles_overrun = cycles_run - budget;
+    return true;
 }
 
 agnes_color_t agnes_get_screen_pixel(const agnes_t *agnes, int x, int y) {
@@ -184,10 +282,82 @@ uint8_t agnes_get_screen_index(const agnes_t *agnes, int x, int y) {
     int ix = (y * AGNES_SCREEN_WIDTH) + x;
     return agnes->ppu.screen_buffer[ix] & 0x3f;
 }
+
+// Scanlines of the screen buffer that changed since the last call, bit y & 7
+// of byte y >> 3 for line y, and starts over. Returns false if none did.
+// Everything is dirty after agnes_load_ines_data() and agnes_restore_state().
+bool agnes_get_dirty_lines(agnes_t *agnes, uint8_t out_lines[AGNES_SCREEN_HEIGHT / 8]) {
+    uint8_t any = 0;
+    for (int i = 0; i < AGNES_SCREEN_HEIGHT / 8; i++) {
+        out_lines[i] = agnes->ppu.dirty_lines[i];
+        any |= out_lines[i];
+    }
+    // Cleared here rather than every frame, skipped frames would lose them
+    memset(agnes->ppu.dirty_lines, 0, sizeof(agnes->ppu.dirty_lines));
+    return any != 0;
+}
+
+// Has the PPU write every scanline that changes to pixels (its top left) in
+// the given format as well, stride is in bytes. Indexed pixels are the NES
+// color plus index_offset. The current screen is written right away, NULL
+// stops the writes.
+void agnes_set_framebuffer(agnes_t *agnes, void *pixels, int stride, agnes_pixel_format_t format, uint8_t index_offset) {
+    framebuffer_set(&agnes->framebuffer, pixels, stride, format, index_offset);
+    framebuffer_write_screen(&agnes->framebuffer, agnes->ppu.screen_buffer);
+}
+
 agnes_color_t *get_gcolors(void) {
     return g_colors;
 }
+// CPU cycles of the last whole frame that were fast-forwarded through idle loops
+uint32_t agnes_get_idle_cycles(const agnes_t *agnes) {
+    return agnes->cpu.idle.frame_skipped_cycles;
+}
+
+// Number of decoded blocks run from the block cache and of those that had to
+// be decoded first, false if it's compiled out (AGNES_BLOCK_CACHE)
+bool agnes_get_block_cache_stats(const agnes_t *agnes, uint32_t *out_hits, uint32_t *out_misses) {
+#if AGNES_BLOCK_CACHE
+    *out_hits = agnes->block_cache->hits;
+    *out_misses = agnes->block_cache->misses;
+    return true;
+#else
+    (void)agnes;
+    *out_hits = 0;
+    *out_misses = 0;
+    return false;
+#endif
+}
+
+// Copies the counters collected since the last agnes_reset_profile(), false
+// if they're compiled out (AGNES_PROFILE)
+bool agnes_get_profile(const agnes_t *agnes, agnes_profile_t *out_profile) {
+#if AGNES_PROFILE
+    *out_profile = agnes->profile;
+    return true;
+#else
+    (void)agnes;
+    memset(out_profile, 0, sizeof(*out_profile));
+    return false;
+#endif
+}
+
+// Call once per frame for per-frame counters
+void agnes_reset_profile(agnes_t *agnes) {
+#if AGNES_PROFILE
+    memset(&agnes->profile, 0, sizeof(agnes->profile));
+#else
+    (void)agnes;
+#endif
+}
+
 void agnes_destroy(agnes_t *agnes) {
+#if AGNES_BLOCK_CACHE
+    block_cache_destroy(agnes->block_cache);
+#endif
+#if AGNES_CHR_CACHE
+    chr_cache_destroy(agnes->chr_cache);
+#endif
     free(agnes);
 }
 
@@ -33,6 +33,32 @@ typedef struct {
     uint8_t a;
 } agnes_color_t;
 
+// Pixel formats of agnes_set_framebuffer(), 16 bit ones in native byte order
+typedef enum {
+    AGNES_PIXEL_FORMAT_INDEXED8, // NES color index plus an offset
+    AGNES_PIXEL_FORMAT_RGB565,
+    AGNES_PIXEL_FORMAT_XRGB1555,
+    AGNES_PIXEL_FORMAT_RGBA8888 // bytes in agnes_color_t order
+} agnes_pixel_format_t;
+
+enum {
+    AGNES_PROFILE_ADDR_MODES = 15,
+    AGNES_PROFILE_REGIONS = 8
+};
+
+// Interpreter counters, only collected in builds with AGNES_PROFILE
+typedef struct {
+    uint32_t opcode_count[256];
+    uint32_t opcode_cycles[256];
+    uint32_t mode_count[AGNES_PROFILE_ADDR_MODES]; // indexed by addr_mode_t
+    uint32_t mode_cycles[AGNES_PROFILE_ADDR_MODES];
+    uint32_t page_cross_cycles; // extra cycles for crossing a page, branches included
+    uint32_t branches_taken;
+    uint32_t branches_not_taken;
+    uint32_t mapper_reads[AGNES_PROFILE_REGIONS]; // CPU accesses by 8KB address range
+    uint32_t mapper_writes[AGNES_PROFILE_REGIONS];
+} agnes_profile_t;
+
 typedef struct agnes agnes_t;
 typedef struct agnes_state agnes_state_t;
 
@@ -45,9 +71,18 @@ void agnes_dump_state(const agnes_t *agnes, agnes_state_t *out_res);
 bool agnes_restore_state(agnes_t *agnes, const agnes_state_t *state);
 bool agnes_tick(agnes_t *agnes, bool *out_new_frame);
 bool agnes_next_frame(agnes_t *agnes);
+bool agnes_next_frame_skip(agnes_t *agnes);
+bool agnes_run_cycles(agnes_t *agnes, int cycles);
 
 agnes_color_t agnes_get_screen_pixel(const agnes_t *agnes, int x, int y);
 uint8_t agnes_get_screen_index(const agnes_t *agnes, int x, int y);
+bool agnes_get_dirty_lines(agnes_t *agnes, uint8_t out_lines[AGNES_SCREEN_HEIGHT / 8]);
+void agnes_set_framebuffer(agnes_t *agnes, void *pixels, int stride, agnes_pixel_format_t format, uint8_t index_offset);
+
+uint32_t agnes_get_idle_cycles(const agnes_t *agnes);
+bool agnes_get_block_cache_stats(const agnes_t *agnes, uint32_t *out_hits, uint32_t *out_misses);
+bool agnes_get_profile(const agnes_t *agnes, agnes_profile_t *out_profile);
+void agnes_reset_profile(agnes_t *agnes);
 
 agnes_color_t *get_gcolors(void);
 
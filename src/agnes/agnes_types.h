@@ -4,6 +4,7 @@
 #ifndef AGNES_SINGLE_HEADER
 #include "common.h"
 #include "agnes.h"
+#include "scheduler.h"
 #endif
 
 /************************************ CPU ************************************/
@@ -30,6 +31,34 @@ typedef struct cpu {
     uint32_t stall;
     uint32_t cycles;
     cpu_interrupt_t cpu_interrupt;
+
+    // One pointer per 256 byte page of the address space, NULL for pages
+    // that have to go through the I/O and mapper handlers
+    const uint8_t *read_pages[256];
+    uint8_t *write_pages[256];
+
+    // When running in stretches (instruction_run()) the PPU lags behind and
+    // is only caught up at sync points
+    struct {
+        int cycles;     // CPU cycles run since the last sync point
+        int ppu_cycles; // how many of those the PPU has already run for
+        int limit;      // cycles at which the next sync point is due
+    } sync;
+
+    // Loop that was last seen spinning, see skip_idle_loop() in instructions.c
+    struct {
+        uint16_t pc; // branch closing the loop, 0 for none
+        uint8_t acc;
+        uint8_t x;
+        uint8_t y;
+        uint8_t flags;
+        uint8_t checked; // 0: body not checked yet, 1: can be skipped, 2: can't
+        bool reads_status;
+        uint32_t cycles; // cpu->cycles when the branch was last taken
+        uint32_t ppu_read_cycles; // cpu->cycles of the last PPU register read
+        uint32_t skipped_cycles;
+        uint32_t frame_skipped_cycles; // skipped_cycles of the last whole frame
+    } idle;
 } cpu_t;
 
 /************************************ PPU ************************************/
@@ -47,7 +76,12 @@ typedef struct ppu {
     uint8_t nametables[4 * 1024];
     uint8_t palette[32];
 
+    // What's at $0000 - $3FFF in 1KB pages, pattern tables from the mapper
+    // and nametables for the mirroring mode, see ppu_update_pages()
+    const uint8_t *pages[16];
+
     uint8_t screen_buffer[AGNES_SCREEN_HEIGHT * AGNES_SCREEN_WIDTH];
+    uint8_t dirty_lines[AGNES_SCREEN_HEIGHT / 8]; // bit y & 7 of byte y >> 3, see agnes_get_dirty_lines()
 
     int scanline;
     int dot;
@@ -99,6 +133,24 @@ typedef struct ppu {
     sprite_t sprites[8];
     int sprite_ixs[8];
     int sprite_ixs_count;
+
+    // For each scanline the OAM indices of the first 8 sprites eval_sprites()
+    // picks and how many there are, up to 9, see bucket_sprites() in ppu.c
+    bool sprite_buckets_valid;
+    uint8_t sprite_bucket_counts[AGNES_SCREEN_HEIGHT];
+    uint8_t sprite_buckets[AGNES_SCREEN_HEIGHT][8];
+
+    // Set by agnes_next_frame_skip(), runs everything but screen_buffer writes
+    bool skip_render;
+
+    // The x sprite 0 hits at on the current scanline, see
+    // predict_sprite_zero_hit() in ppu.c
+    int sprite_zero_x;
+
+    // The pixels of sprites[] on the current scanline, see render_sprite_line()
+    // in ppu.c, only valid during one ppu_run()
+    bool sprite_line_valid;
+    uint8_t sprite_line[AGNES_SCREEN_WIDTH];
 } ppu_t;
 
 /********************************** MAPPERS **********************************/
@@ -180,6 +232,26 @@ typedef struct controller {
     uint8_t shift;
 } controller_t;
 
+/********************************* SCHEDULER *********************************/
+
+// Next due time of each event_t on a master clock of CPU cycles, DMA stall
+// cycles included, that keeps counting across runs
+typedef struct scheduler {
+    uint32_t now; // master cycle of the last sync point
+    uint8_t pending; // bit per event_t with a due time
+    uint32_t due[EVENT_COUNT];
+} scheduler_t;
+
+/******************************** FRAMEBUFFER ********************************/
+
+// Where agnes_set_framebuffer() has the PPU write finished scanlines to
+typedef struct framebuffer {
+    uint8_t *pixels; // top left of the 256x240 screen, NULL for none
+    int stride; // bytes from one line to the next
+    agnes_pixel_format_t format;
+    uint32_t colors[64]; // each NES color in the format
+} framebuffer_t;
+
 /*********************************** AGNES ***********************************/
 typedef struct agnes {
     cpu_t cpu;
@@ -197,6 +269,25 @@ typedef struct agnes {
     } mapper;
 
     mirroring_mode_t mirroring_mode;
+
+    scheduler_t scheduler;
+
+    framebuffer_t framebuffer;
+
+    // Cycles agnes_run_cycles() ran past the end of the last budget
+    int cycles_overrun;
+
+#if AGNES_BLOCK_CACHE
+    struct block_cache *block_cache;
+#endif
+
+#if AGNES_CHR_CACHE
+    struct chr_cache *chr_cache;
+#endif
+
+#if AGNES_PROFILE
+    agnes_profile_t profile;
+#endif
 } agnes_t;
 
 #endif /* agnes_types_h */
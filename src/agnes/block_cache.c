@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef AGNES_SINGLE_HEADER
+#include "block_cache.h"
+
+#include "agnes_types.h"
+#include "instructions.h"
+#endif
+
+#if AGNES_BLOCK_CACHE
+
+static void decode_block(block_t *block, uint16_t pc, const uint8_t *page);
+static bool ends_block(const instruction_t *ins);
+
+block_cache_t* block_cache_make(void) {
+    block_cache_t *cache = (block_cache_t*)malloc(sizeof(*cache));
+    if (!cache) {
+        return NULL;
+    }
+    block_cache_flush(cache);
+    return cache;
+}
+
+void block_cache_destroy(block_cache_t *cache) {
+    free(cache);
+}
+
+void block_cache_flush(block_cache_t *cache) {
+    memset(cache, 0, sizeof(*cache));
+}
+
+// Returns the block starting at cpu->pc, decoding it on a miss, or NULL if the
+// code there can't be cached (not PRG ROM or an illegal opcode)
+const block_t* block_cache_get(block_cache_t *cache, cpu_t *cpu) {
+    uint16_t pc = cpu->pc;
+    const uint8_t *page = cpu->read_pages[pc >> 8];
+    if (pc < 0x8000 || !page) {
+        return NULL;
+    }
+
+    // The page pointer tells apart the PRG banks that can be mapped at pc,
+    // so bank switches don't have to flush anything
+    block_t *block = &cache->blocks[(pc ^ (pc >> 8)) & (AGNES_BLOCK_CACHE_SIZE - 1)];
+    if (block->pc == pc && block->page == page) {
+        cache->hits++;
+    } else {
+        cache->misses++;
+        decode_block(block, pc, page);
+    }
+    return block->count > 0 ? block : NULL;
+}
+
+static void decode_block(block_t *block, uint16_t pc, const uint8_t *page) {
+    block->pc = pc;
+    block->page = page;
+    block->count = 0;
+
+    unsigned offset = pc & 0xff;
+    while (block->count < BLOCK_MAX_INSTRUCTIONS) {
+        const instruction_t *ins = instruction_get(page[offset]);
+        unsigned size = instruction_get_size(ins->mode);
+        if (!ins->decoded_handler || offset + size > 256) {
+            break;
+        }
+
+        block_instruction_t *out = &block->instructions[block->count++];
+        out->handler = ins->decoded_handler;
+        out->operands = instruction_decode_operand(ins->mode, (pc & 0xff00) | offset, page + offset);
+        offset += size;
+
+        // Common pairs run as one entry, see instruction_get_fused()
+        if (!ends_block(ins) && offset < 256) {
+            const instruction_t *next = instruction_get(page[offset]);
+            unsigned next_size = instruction_get_size(next->mode);
+            instruction_decoded_fn fused = instruction_get_fused(ins->opcode, next->opcode);
+            if (fused && offset + next_size <= 256) {
+                uint16_t next_operand = instruction_decode_operand(next->mode, (pc & 0xff00) | offset, page + offset);
+                out->handler = fused;
+                out->operands |= (uint32_t)next_operand << 16;
+                offset += next_size;
+                ins = next;
+            }
+        }
+
+        if (ends_block(ins)) {
+            break;
+        }
+    }
+}
+
+static bool ends_block(const instruction_t *ins) {
+    switch (ins->opcode) {
+        case 0x00: // BRK
+        case 0x20: // JSR
+        case 0x40: // RTI
+        case 0x4c: // JMP
+        case 0x60: // RTS
+        case 0x6c: // JMP (indirect)
+            return true;
+        default:
+            return ins->mode == ADDR_MODE_RELATIVE;
+    }
+}
+
+#endif
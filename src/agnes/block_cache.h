@@ -0,0 +1,38 @@
+#ifndef block_cache_h
+#define block_cache_h
+
+#ifndef AGNES_SINGLE_HEADER
+#include "common.h"
+#include "instructions.h"
+#endif
+
+#define BLOCK_MAX_INSTRUCTIONS 16
+
+typedef struct cpu cpu_t;
+
+typedef struct {
+    instruction_decoded_fn handler;
+    uint32_t operands;
+} block_instruction_t;
+
+// Straight-line code up to and including the first jump, branch or return,
+// never crossing a 256 byte page
+typedef struct {
+    uint16_t pc; // 0 for a free slot, only code from 0x8000 up is cached
+    const uint8_t *page; // PRG ROM page the block was decoded from
+    uint8_t count;
+    block_instruction_t instructions[BLOCK_MAX_INSTRUCTIONS];
+} block_t;
+
+typedef struct block_cache {
+    uint32_t hits;
+    uint32_t misses;
+    block_t blocks[AGNES_BLOCK_CACHE_SIZE];
+} block_cache_t;
+
+AGNES_INTERNAL block_cache_t* block_cache_make(void);
+AGNES_INTERNAL void block_cache_destroy(block_cache_t *cache);
+AGNES_INTERNAL void block_cache_flush(block_cache_t *cache);
+AGNES_INTERNAL const block_t* block_cache_get(block_cache_t *cache, cpu_t *cpu);
+
+#endif /* block_cache_h */
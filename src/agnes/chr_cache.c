@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef AGNES_SINGLE_HEADER
+#include "chr_cache.h"
+
+#include "agnes_types.h"
+#include "mapper.h"
+#endif
+
+#if AGNES_CHR_CACHE
+
+static void decode_tile(chr_cache_t *cache, agnes_t *agnes, unsigned tile);
+
+chr_cache_t* chr_cache_make(void) {
+    chr_cache_t *cache = (chr_cache_t*)malloc(sizeof(*cache));
+    if (!cache) {
+        return NULL;
+    }
+    chr_cache_flush(cache);
+    return cache;
+}
+
+void chr_cache_destroy(chr_cache_t *cache) {
+    free(cache);
+}
+
+void chr_cache_flush(chr_cache_t *cache) {
+    memset(cache->valid, 0, sizeof(cache->valid));
+}
+
+// Drops the tiles overlapping size bytes of pattern memory at addr
+void chr_cache_invalidate(chr_cache_t *cache, uint16_t addr, unsigned size) {
+    unsigned first = (addr & 0x1fff) >> 4;
+    unsigned last = ((addr & 0x1fff) + size - 1) >> 4;
+    memset(&cache->valid[first], 0, last - first + 1);
+}
+
+// The row of the tile at addr (the address of its low plane byte, so offsets
+// 0-7 into the tile), decoding the whole tile on a miss
+uint16_t chr_cache_get_row(chr_cache_t *cache, agnes_t *agnes, uint16_t addr) {
+    unsigned tile = (addr & 0x1fff) >> 4;
+    if (!cache->valid[tile]) {
+        decode_tile(cache, agnes, tile);
+    }
+    return cache->rows[tile][addr & 0x7];
+}
+
+static void decode_tile(chr_cache_t *cache, agnes_t *agnes, unsigned tile) {
+    uint16_t addr = tile << 4;
+    for (int y = 0; y < 8; y++) {
+        uint8_t lo = mapper_read(agnes, addr + y);
+        uint8_t hi = mapper_read(agnes, addr + y + 8);
+        uint16_t row = 0;
+        for (int x = 0; x < 8; x++) {
+            row = (row << 2) | (AGNES_GET_BIT(hi, 7 - x) << 1) | AGNES_GET_BIT(lo, 7 - x);
+        }
+        cache->rows[tile][y] = row;
+    }
+    cache->valid[tile] = true;
+}
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef chr_cache_h
+#define chr_cache_h
+
+#ifndef AGNES_SINGLE_HEADER
+#include "common.h"
+#endif
+
+#define CHR_CACHE_TILES 512 // $0000 - $1FFF
+
+typedef struct agnes agnes_t;
+
+// The tiles currently mapped at $0000 - $1FFF, each row as 2 bit chunky
+// pixels with the leftmost one in the top bits. Mappers invalidate tiles when
+// CHR RAM is written or a CHR bank switch maps in different data.
+typedef struct chr_cache {
+    bool valid[CHR_CACHE_TILES];
+    uint16_t rows[CHR_CACHE_TILES][8];
+} chr_cache_t;
+
+AGNES_INTERNAL chr_cache_t* chr_cache_make(void);
+AGNES_INTERNAL void chr_cache_destroy(chr_cache_t *cache);
+AGNES_INTERNAL void chr_cache_flush(chr_cache_t *cache);
+AGNES_INTERNAL void chr_cache_invalidate(chr_cache_t *cache, uint16_t addr, unsigned size);
+AGNES_INTERNAL uint16_t chr_cache_get_row(chr_cache_t *cache, agnes_t *agnes, uint16_t addr);
+
+#endif /* chr_cache_h */
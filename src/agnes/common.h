@@ -13,4 +13,59 @@
 
 #define AGNES_GET_BIT(byte, bit_ix) (((byte) >> (bit_ix)) & 1)
 
+#if defined(__GNUC__)
+#define AGNES_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define AGNES_ALWAYS_INLINE inline
+#endif
+
+// CPU loop used by agnes_next_frame(), override with -DAGNES_DISPATCH=...
+// AGNES_DISPATCH_TICK:     one cpu_tick() call per instruction
+// AGNES_DISPATCH_SWITCH:   switch on the opcode, a whole frame per call
+// AGNES_DISPATCH_THREADED: computed goto (GNU C labels as values), a whole frame per call
+#define AGNES_DISPATCH_TICK 0
+#define AGNES_DISPATCH_SWITCH 1
+#define AGNES_DISPATCH_THREADED 2
+
+#ifndef AGNES_DISPATCH
+#if defined(__GNUC__)
+#define AGNES_DISPATCH AGNES_DISPATCH_THREADED
+#else
+#define AGNES_DISPATCH AGNES_DISPATCH_SWITCH
+#endif
+#endif
+
+// Keep Z, N and V as the values they're derived from and only work them out
+// when a branch or P needs them, override with -DAGNES_LAZY_FLAGS=0
+#ifndef AGNES_LAZY_FLAGS
+#define AGNES_LAZY_FLAGS 1
+#endif
+
+// Fast-forward through loops that spin until an interrupt or PPUSTATUS change
+#ifndef AGNES_SKIP_IDLE_LOOPS
+#define AGNES_SKIP_IDLE_LOOPS 1
+#endif
+
+// Run code in PRG ROM from a cache of decoded blocks, costs about
+// AGNES_BLOCK_CACHE_SIZE * 80 bytes of memory so it's off by default
+#ifndef AGNES_BLOCK_CACHE
+#define AGNES_BLOCK_CACHE 0
+#endif
+
+#ifndef AGNES_BLOCK_CACHE_SIZE
+#define AGNES_BLOCK_CACHE_SIZE 256 // power of 2
+#endif
+
+// Keep the pattern tables decoded to chunky pixels for the background and
+// sprite fetches, costs about 8.5KB of memory so it's off by default
+#ifndef AGNES_CHR_CACHE
+#define AGNES_CHR_CACHE 0
+#endif
+
+// Count executions per opcode and addressing mode, branches and mapper calls
+// for agnes_get_profile(), compiled out by default
+#ifndef AGNES_PROFILE
+#define AGNES_PROFILE 0
+#endif
+
 #endif /* common_h */
@@ -9,14 +9,10 @@
 #include "mapper.h"
 #endif
 
-static uint16_t cpu_read16_indirect_bug(cpu_t *cpu, uint16_t addr);
-static uint16_t get_instruction_operand(cpu_t *cpu, addr_mode_t mode, bool *out_pages_differ);
-static int handle_interrupt(cpu_t *cpu);
-static bool check_pages_differ(uint16_t a, uint16_t b);
-
 void cpu_init(cpu_t *cpu, agnes_t *agnes) {
     memset(cpu, 0, sizeof(cpu_t));
     cpu->agnes = agnes;
+    cpu_update_pages(cpu);
     cpu->pc = cpu_read16(cpu, 0xfffc); // RESET
     cpu->sp = 0xfd;
     cpu_restore_flags(cpu, 0x24);
@@ -31,81 +27,71 @@ int cpu_tick(cpu_t *cpu) {
     int cycles = 0;
 
     if (cpu->cpu_interrupt != INTERRUPT_NONE) {
-        cycles += handle_interrupt(cpu);
+        cycles += cpu_handle_interrupt(cpu);
     }
 
     uint8_t opcode = cpu_read8(cpu, cpu->pc);
-    instruction_t *ins = instruction_get(opcode);
-    if (ins->operation == NULL) {
+    instruction_handler_fn handler = instruction_get_exec(opcode)->handler;
+    if (handler == NULL) {
         return 0;
     }
-    
-    uint8_t ins_size = instruction_get_size(ins->mode);
-    bool page_crossed = false;
-    uint16_t addr = get_instruction_operand(cpu, ins->mode, &page_crossed);
-
-    cpu->pc += ins_size;
-
-    cycles += ins->cycles;
-    cycles += ins->operation(cpu, addr, ins->mode);
 
-    if (page_crossed && ins->page_cross_cycle) {
-        cycles += 1;
-    }
+    cycles += handler(cpu);
 
     cpu->cycles += cycles;
 
     return cycles;
 }
 
-void cpu_update_zn_flags(cpu_t *cpu, uint8_t val) {
-    cpu->flag_zero = val == 0;
-    cpu->flag_negative = AGNES_GET_BIT(val, 7);
-}
-
+// The stack and zero page are always internal RAM, so they skip the address
+// decoding of cpu_read8() and cpu_write8()
 void cpu_stack_push8(cpu_t *cpu, uint8_t val) {
-    uint16_t addr = 0x0100 + (uint16_t)(cpu->sp);
-    cpu_write8(cpu, addr, val);
+    cpu->agnes->ram[0x100 | cpu->sp] = val;
     cpu->sp--;
 }
 
 void cpu_stack_push16(cpu_t *cpu, uint16_t val) {
-    cpu_stack_push8(cpu, val >> 8);
-    cpu_stack_push8(cpu, val);
+    uint8_t *stack = cpu->agnes->ram + 0x100;
+    stack[cpu->sp--] = val >> 8;
+    stack[cpu->sp--] = val & 0xff;
 }
 
 uint8_t cpu_stack_pop8(cpu_t *cpu) {
     cpu->sp++;
-    uint16_t addr = 0x0100 + (uint16_t)(cpu->sp);
-    uint8_t res = cpu_read8(cpu, addr);
-    return res;
+    return cpu->agnes->ram[0x100 | cpu->sp];
 }
 
 uint16_t cpu_stack_pop16(cpu_t *cpu) {
-    uint16_t lo = cpu_stack_pop8(cpu);
-    uint16_t hi = cpu_stack_pop8(cpu);
-    uint16_t res = (hi << 8) | lo;
-    return res;
+    const uint8_t *stack = cpu->agnes->ram + 0x100;
+    uint16_t lo = stack[++cpu->sp];
+    uint16_t hi = stack[++cpu->sp];
+    return (hi << 8) | lo;
+}
+
+// Reads a pointer from zero page, wrapping around within it like the 6502
+uint16_t cpu_read16_zero_page(cpu_t *cpu, uint8_t addr) {
+    const uint8_t *ram = cpu->agnes->ram;
+    return (ram[(uint8_t)(addr + 1)] << 8) | ram[addr];
 }
 
 uint8_t cpu_get_flags(const cpu_t *cpu) {
     uint8_t res = 0;
     res |= cpu->flag_carry         << 0;
-    res |= cpu->flag_zero          << 1;
+    res |= CPU_FLAG_Z(cpu)         << 1;
     res |= cpu->flag_dis_interrupt << 2;
     res |= cpu->flag_decimal       << 3;
-    res |= cpu->flag_overflow      << 6;
-    res |= cpu->flag_negative      << 7;
+    res |= CPU_FLAG_V(cpu)         << 6;
+    res |= CPU_FLAG_N(cpu)         << 7;
     return res;
 }
 
 void cpu_restore_flags(cpu_t *cpu, uint8_t flags) {
     cpu->flag_carry         = AGNES_GET_BIT(flags, 0);
-    cpu->flag_zero          = AGNES_GET_BIT(flags, 1);
     cpu->flag_dis_interrupt = AGNES_GET_BIT(flags, 2);
     cpu->flag_decimal       = AGNES_GET_BIT(flags, 3);
-    cpu->flag_overflow      = AGNES_GET_BIT(flags, 6);
-    cpu->flag_negative      = AGNES_GET_BIT(flags, 7);
+    CPU_SET_Z_FROM(cpu, !AGNES_GET_BIT(flags, 1));
+    CPU_SET_V_FROM(cpu, flags << 1);
+    CPU_SET_N_FROM(cpu, flags);
 }
 
 void cpu_trigger_nmi(cpu_t *cpu) {
@@ -123,13 +109,23 @@ void cpu_set_dma_stall(cpu_t *cpu) {
 }
 
 void cpu_write8(cpu_t *cpu, uint16_t addr, uint8_t val) {
+    uint8_t *page = cpu->write_pages[addr >> 8];
+    if (page) {
+        page[addr & 0xff] = val;
+        return;
+    }
+
     agnes_t *agnes = cpu->agnes;
 
-    if (addr < 0x2000) {
-        agnes->ram[addr & 0x7ff] = val;
-    } else if (addr < 0x4000) {
+    // Reads can't move the next PPU event but writes can, so they also make
+    // the run loop work it out again
+    if (addr < 0x4000) {
+        cpu_sync_ppu(cpu);
+        cpu->sync.limit = 0;
         ppu_write_register(&agnes->ppu, 0x2000 | (addr & 0x7), val);
     } else if (addr == 0x4014) {
+        cpu_sync_ppu(cpu);
+        cpu->sync.limit = 0;
         ppu_write_register(&agnes->ppu, 0x4014, val);
     } else if (addr == 0x4016) {
         agnes->controllers_latch = val & 0x1;
@@ -138,19 +134,33 @@ void cpu_write8(cpu_t *cpu, uint16_t addr, uint8_t val) {
             agnes->controllers[1].shift = agnes->controllers[1].state;
         }
     } else {
+        // APU registers and PRG banking are of no concern to the PPU
+        if (mapper_write_affects_ppu(agnes, addr, val)) {
+            cpu_sync_ppu(cpu);
+            cpu->sync.limit = 0;
+        }
+        if (addr >= 0x4020) { // not the APU and I/O registers
+            CPU_PROFILE_COUNT(cpu, mapper_writes[addr >> 13], 1);
+        }
         mapper_write(agnes, addr, val);
     }
 }
 
 uint8_t cpu_read8(cpu_t *cpu, uint16_t addr) {
+    const uint8_t *page = cpu->read_pages[addr >> 8];
+    if (page) {
+        return page[addr & 0xff];
+    }
+
     agnes_t *agnes = cpu->agnes;
 
     uint8_t res = 0;
-    if (addr >= 0x4020) { // moved to top because it's the most common case
+    if (addr >= 0x4020) {
+        CPU_PROFILE_COUNT(cpu, mapper_reads[addr >> 13], 1);
         res = mapper_read(agnes, addr);
-    } else if (addr < 0x2000) {
-        res = agnes->ram[addr & 0x7ff];
     } else if (addr < 0x4000) {
+        cpu_sync_ppu(cpu);
+        cpu->idle.ppu_read_cycles = cpu->cycles;
         res = ppu_read_register(&agnes->ppu, 0x2000 | (addr & 0x7));
     } else if (addr < 0x4016) {
         // apu
@@ -165,79 +175,51 @@ uint8_t cpu_read8(cpu_t *cpu, uint16_t addr) {
     return res;
 }
 
+// Catches the PPU up to the start of the current instruction before the CPU
+// observes or changes PPU or mapper state
+void cpu_sync_ppu(cpu_t *cpu) {
+    int cycles = cpu->sync.cycles - cpu->sync.ppu_cycles;
+    if (cycles > 0) {
+        // The next NMI, IRQ or frame is always past the start of the current
+        // instruction (see ppu_schedule_events()), so it can't show up here
+        bool new_frame = false;
+        ppu_run(&cpu->agnes->ppu, cycles, &new_frame);
+        cpu->sync.ppu_cycles = cpu->sync.cycles;
+    }
+}
+
 uint16_t cpu_read16(cpu_t *cpu, uint16_t addr) {
     uint8_t lo = cpu_read8(cpu, addr);
     uint8_t hi = cpu_read8(cpu, addr + 1);
     return (hi << 8) | lo;
 }
 
-static uint16_t cpu_read16_indirect_bug(cpu_t *cpu, uint16_t addr) {
-    uint8_t lo = cpu_read8(cpu, addr);
-    uint8_t hi = cpu_read8(cpu, (addr & 0xff00) | ((addr + 1) & 0x00ff));
-    return (hi << 8) | lo;
+// Maps size bytes (a multiple of 256) starting at addr to read and write,
+// either of which can be NULL to leave those accesses to the handlers
+void cpu_map_memory(cpu_t *cpu, uint16_t addr, unsigned size, const uint8_t *read, uint8_t *write) {
+    unsigned first_page = addr >> 8;
+    unsigned pages_count = size >> 8;
+    for (unsigned i = 0; i < pages_count; i++) {
+        const uint8_t *read_page = read ? read + (i << 8) : NULL;
+#if AGNES_BLOCK_CACHE
+        if (cpu->read_pages[first_page + i] != read_page) {
+            cpu->sync.limit = 0; // stop a decoded block running from the old bank
+        }
+#endif
+        cpu->read_pages[first_page + i] = read_page;
+        cpu->write_pages[first_page + i] = write ? write + (i << 8) : NULL;
+    }
 }
 
-static uint16_t get_instruction_operand(cpu_t *cpu, addr_mode_t mode, bool *out_pages_differ) {
-    *out_pages_differ = false;
-    switch (mode) {
-        case ADDR_MODE_ABSOLUTE: {
-            return cpu_read16(cpu, cpu->pc + 1);
-        }
-        case ADDR_MODE_ABSOLUTE_X: {
-            uint16_t addr = cpu_read16(cpu, cpu->pc + 1);
-            uint16_t res = addr + cpu->x;
-            *out_pages_differ = check_pages_differ(addr, res);
-            return res;
-        }
-        case ADDR_MODE_ABSOLUTE_Y: {
-            uint16_t addr = cpu_read16(cpu, cpu->pc + 1);
-            uint16_t res = addr + cpu->y;
-            *out_pages_differ = check_pages_differ(addr, res);
-            return res;
-        }
-        case ADDR_MODE_IMMEDIATE: {
-            return cpu->pc + 1;
-        }
-        case ADDR_MODE_INDIRECT: {
-            uint16_t addr = cpu_read16(cpu, cpu->pc + 1);
-            return cpu_read16_indirect_bug(cpu, addr);
-        }
-        case ADDR_MODE_INDIRECT_X: {
-            uint8_t addr = cpu_read8(cpu, (cpu->pc + 1));
-            return cpu_read16_indirect_bug(cpu, (addr + cpu->x) & 0xff);
-        }
-        case ADDR_MODE_INDIRECT_Y: {
-            uint8_t arg = cpu_read8(cpu, cpu->pc + 1);
-            uint16_t addr2 = cpu_read16_indirect_bug(cpu, arg);
-            uint16_t res = addr2 + cpu->y;
-            *out_pages_differ = check_pages_differ(addr2, res);
-            return res;
-        }
-        case ADDR_MODE_ZERO_PAGE: {
-            return cpu_read8(cpu, cpu->pc + 1);
-        }
-        case ADDR_MODE_ZERO_PAGE_X: {
-            return (cpu_read8(cpu, cpu->pc + 1) + cpu->x) & 0xff;
-        }
-        case ADDR_MODE_ZERO_PAGE_Y: {
-            return (cpu_read8(cpu, cpu->pc + 1) + cpu->y) & 0xff;
-        }
-        case ADDR_MODE_RELATIVE: {
-            uint8_t addr = cpu_read8(cpu, cpu->pc + 1);
-            uint16_t ret_val = cpu->pc + addr + 2;
-            if (addr < 0x80) {
-                return ret_val;
-            } else {
-                return ret_val - 0x100;
-            }
-        }
-        default: {
-            return 0;
-        }
+void cpu_update_pages(cpu_t *cpu) {
+    agnes_t *agnes = cpu->agnes;
+    for (unsigned addr = 0; addr < 0x2000; addr += sizeof(agnes->ram)) { // RAM and its mirrors
+        cpu_map_memory(cpu, addr, sizeof(agnes->ram), agnes->ram, agnes->ram);
     }
+    mapper_update_pages(agnes);
 }
 
-static int handle_interrupt(cpu_t *cpu) {
+int cpu_handle_interrupt(cpu_t *cpu) {
     uint16_t addr = 0;
     if (cpu->cpu_interrupt == INTERRUPT_NMI) {
         addr = 0xfffa;
@@ -247,6 +229,7 @@ static int handle_interrupt(cpu_t *cpu) {
         return 0;
     }
     cpu->cpu_interrupt = INTERRUPT_NONE;
+    cpu->idle.pc = 0; // the handler can change what a loop is waiting on
     cpu_stack_push16(cpu, cpu->pc);
     uint8_t flags = cpu_get_flags(cpu);
     cpu_stack_push8(cpu, flags | 0x20);
@@ -254,7 +237,3 @@ static int handle_interrupt(cpu_t *cpu) {
     cpu->flag_dis_interrupt = true;
     return 7;
 }
-
-static bool check_pages_differ(uint16_t a, uint16_t b) {
-    return (0xff00 & a) != (0xff00 & b);
-}
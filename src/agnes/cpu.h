@@ -8,13 +8,45 @@
 typedef struct agnes agnes_t;
 typedef struct cpu cpu_t;
 
+// With AGNES_LAZY_FLAGS flag_zero, flag_negative and flag_overflow hold the
+// last value the flag comes from instead of 0/1: Z is set when flag_zero is 0,
+// N and V are bit 7 of flag_negative and flag_overflow.
+#if AGNES_LAZY_FLAGS
+#define CPU_FLAG_Z(cpu) ((cpu)->flag_zero == 0)
+#define CPU_FLAG_N(cpu) AGNES_GET_BIT((cpu)->flag_negative, 7)
+#define CPU_FLAG_V(cpu) AGNES_GET_BIT((cpu)->flag_overflow, 7)
+#define CPU_SET_Z_FROM(cpu, val) ((cpu)->flag_zero = (uint8_t)(val))
+#define CPU_SET_N_FROM(cpu, val) ((cpu)->flag_negative = (uint8_t)(val))
+#define CPU_SET_V_FROM(cpu, val) ((cpu)->flag_overflow = (uint8_t)(val))
+#else
+#define CPU_FLAG_Z(cpu) ((cpu)->flag_zero)
+#define CPU_FLAG_N(cpu) ((cpu)->flag_negative)
+#define CPU_FLAG_V(cpu) ((cpu)->flag_overflow)
+#define CPU_SET_Z_FROM(cpu, val) ((cpu)->flag_zero = (uint8_t)(val) == 0)
+#define CPU_SET_N_FROM(cpu, val) ((cpu)->flag_negative = AGNES_GET_BIT((uint8_t)(val), 7))
+#define CPU_SET_V_FROM(cpu, val) ((cpu)->flag_overflow = AGNES_GET_BIT((uint8_t)(val), 7))
+#endif
+#define CPU_SET_ZN(cpu, val) do { \
+    uint8_t zn_val_ = (uint8_t)(val); \
+    CPU_SET_Z_FROM(cpu, zn_val_); \
+    CPU_SET_N_FROM(cpu, zn_val_); \
+} while (0)
+
+// Bumps a counter of agnes_profile_t, nothing without AGNES_PROFILE
+#if AGNES_PROFILE
+#define CPU_PROFILE_COUNT(cpu, counter, n) ((cpu)->agnes->profile.counter += (n))
+#else
+#define CPU_PROFILE_COUNT(cpu, counter, n) ((void)0)
+#endif
+
 AGNES_INTERNAL void cpu_init(cpu_t *cpu, agnes_t *agnes);
 AGNES_INTERNAL int cpu_tick(cpu_t *cpu);
-AGNES_INTERNAL void cpu_update_zn_flags(cpu_t *cpu, uint8_t val);
+AGNES_INTERNAL int cpu_handle_interrupt(cpu_t *cpu);
 AGNES_INTERNAL void cpu_stack_push8(cpu_t *cpu, uint8_t val);
 AGNES_INTERNAL void cpu_stack_push16(cpu_t *cpu, uint16_t val);
 AGNES_INTERNAL uint8_t cpu_stack_pop8(cpu_t *cpu);
 AGNES_INTERNAL uint16_t cpu_stack_pop16(cpu_t *cpu);
+AGNES_INTERNAL uint16_t cpu_read16_zero_page(cpu_t *cpu, uint8_t addr);
 AGNES_INTERNAL uint8_t cpu_get_flags(const cpu_t *cpu);
 AGNES_INTERNAL void cpu_restore_flags(cpu_t *cpu, uint8_t flags);
 AGNES_INTERNAL void cpu_set_dma_stall(cpu_t *cpu);
@@ -23,5 +55,8 @@ AGNES_INTERNAL void cpu_trigger_irq(cpu_t *cpu);
 AGNES_INTERNAL void cpu_write8(cpu_t *cpu, uint16_t addr, uint8_t val);
 AGNES_INTERNAL uint8_t cpu_read8(cpu_t *cpu, uint16_t addr);
 AGNES_INTERNAL uint16_t cpu_read16(cpu_t *cpu, uint16_t addr);
+AGNES_INTERNAL void cpu_sync_ppu(cpu_t *cpu);
+AGNES_INTERNAL void cpu_map_memory(cpu_t *cpu, uint16_t addr, unsigned size, const uint8_t *read, uint8_t *write);
+AGNES_INTERNAL void cpu_update_pages(cpu_t *cpu);
 
 #endif /* cpu_h */
@@ -0,0 +1,97 @@
+#include <string.h>
+
+#ifndef AGNES_SINGLE_HEADER
+#include "framebuffer.h"
+
+#include "agnes_types.h"
+#endif
+
+// Works out every NES color in the format once, palette RAM changes don't
+// matter since the screen buffer already holds NES colors
+void framebuffer_set(framebuffer_t *fb, void *pixels, int stride, agnes_pixel_format_t format, uint8_t index_offset) {
+    fb->pixels = (uint8_t*)pixels;
+    fb->stride = stride;
+    fb->format = format;
+
+    const agnes_color_t *colors = get_gcolors();
+    for (int i = 0; i < 64; i++) {
+        agnes_color_t c = colors[i];
+        switch (format) {
+            case AGNES_PIXEL_FORMAT_INDEXED8:
+                fb->colors[i] = (uint8_t)(i + index_offset);
+                break;
+            case AGNES_PIXEL_FORMAT_RGB565:
+                fb->colors[i] = ((c.r >> 3) << 11) | ((c.g >> 2) << 5) | (c.b >> 3);
+                break;
+            case AGNES_PIXEL_FORMAT_XRGB1555:
+                fb->colors[i] = ((c.r >> 3) << 10) | ((c.g >> 3) << 5) | (c.b >> 3);
+                break;
+            case AGNES_PIXEL_FORMAT_RGBA8888:
+                memcpy(&fb->colors[i], &c, 4); // r, g, b, a in memory
+                break;
+        }
+    }
+}
+
+// Converts line y of the screen buffer into the framebuffer, if there's one
+void framebuffer_write_line(const framebuffer_t *fb, int y, const uint8_t *line) {
+    if (!fb->pixels) {
+        return;
+    }
+
+    uint8_t *out = fb->pixels + y * fb->stride;
+    switch (fb->format) {
+        case AGNES_PIXEL_FORMAT_INDEXED8: {
+            for (int x = 0; x < AGNES_SCREEN_WIDTH; x++) {
+                out[x] = (uint8_t)fb->colors[line[x] & 0x3f];
+            }
+            break;
+        }
+        case AGNES_PIXEL_FORMAT_RGB565:
+        case AGNES_PIXEL_FORMAT_XRGB1555: {
+            for (int x = 0; x < AGNES_SCREEN_WIDTH; x++) {
+                uint16_t pixel = (uint16_t)fb->colors[line[x] & 0x3f];
+                memcpy(out + (x << 1), &pixel, 2);
+            }
+            break;
+        }
+        case AGNES_PIXEL_FORMAT_RGBA8888: {
+            for (int x = 0; x < AGNES_SCREEN_WIDTH; x++) {
+                memcpy(out + (x << 2), &fb->colors[line[x] & 0x3f], 4);
+            }
+            break;
+        }
+    }
+}
+
+// The same for one pixel, lines drawn dot by dot can change anywhere
+void framebuffer_write_pixel(const framebuffer_t *fb, int x, int y, uint8_t color) {
+    if (!fb->pixels) {
+        return;
+    }
+
+    uint8_t *out = fb->pixels + y * fb->stride;
+    uint32_t pixel = fb->colors[color & 0x3f];
+    switch (fb->format) {
+        case AGNES_PIXEL_FORMAT_INDEXED8: {
+            out[x] = (uint8_t)pixel;
+            break;
+        }
+        case AGNES_PIXEL_FORMAT_RGB565:
+        case AGNES_PIXEL_FORMAT_XRGB1555: {
+            uint16_t pixel16 = (uint16_t)pixel;
+            memcpy(out + (x << 1), &pixel16, 2);
+            break;
+        }
+        case AGNES_PIXEL_FORMAT_RGBA8888: {
+            memcpy(out + (x << 2), &pixel, 4);
+            break;
+        }
+    }
+}
+
+void framebuffer_write_screen(const framebuffer_t *fb, const uint8_t *screen_buffer) {
+    for (int y = 0; y < AGNES_SCREEN_HEIGHT; y++) {
+        framebuffer_write_line(fb, y, screen_buffer + y * AGNES_SCREEN_WIDTH);
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef framebuffer_h
+#define framebuffer_h
+
+#ifndef AGNES_SINGLE_HEADER
+#include "common.h"
+#include "agnes.h"
+#endif
+
+typedef struct framebuffer framebuffer_t;
+
+AGNES_INTERNAL void framebuffer_set(framebuffer_t *fb, void *pixels, int stride, agnes_pixel_format_t format, uint8_t index_offset);
+AGNES_INTERNAL void framebuffer_write_line(const framebuffer_t *fb, int y, const uint8_t *line);
+AGNES_INTERNAL void framebuffer_write_pixel(const framebuffer_t *fb, int x, int y, uint8_t color);
+AGNES_INTERNAL void framebuffer_write_screen(const framebuffer_t *fb, const uint8_t *screen_buffer);
+
+#endif /* framebuffer_h */
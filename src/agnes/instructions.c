@@ -3,424 +3,624 @@
 
 #include "agnes_types.h"
 #include "cpu.h"
+#include "ppu.h"
+#include "scheduler.h"
+#include "block_cache.h"
 #endif
 
-static int op_adc(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_and(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_asl(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_bcc(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_bcs(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_beq(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_bit(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_bmi(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_bne(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_bpl(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_brk(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_bvc(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_bvs(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_clc(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_cld(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_cli(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_clv(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_cmp(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_cpx(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_cpy(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_dec(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_dex(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_dey(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_eor(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_inc(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_inx(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_iny(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_jmp(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_jsr(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_lda(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_ldx(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_ldy(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_lsr(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_nop(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_ora(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_pha(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_php(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_pla(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_plp(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_rol(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_ror(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_rti(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_rts(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_sbc(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_sec(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_sed(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_sei(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_sta(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_stx(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_sty(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_tax(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_tay(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_tsx(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_txa(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_txs(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
-static int op_tya(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_adc(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_and(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_asl(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_bcc(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_bcs(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_beq(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_bit(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_bmi(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_bne(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_bpl(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_brk(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_bvc(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_bvs(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_clc(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_cld(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_cli(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_clv(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_cmp(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_cpx(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_cpy(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_dec(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_dex(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_dey(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_eor(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_inc(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_inx(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_iny(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_jmp(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_jsr(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_lda(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_ldx(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_ldy(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_lsr(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_nop(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_ora(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_pha(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_php(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_pla(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_plp(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_rol(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_ror(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_rti(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_rts(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_sbc(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_sec(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_sed(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_sei(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_sta(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_stx(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_sty(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_tax(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_tay(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_tsx(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_txa(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_txs(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE int op_tya(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
 
 static int take_branch(cpu_t *cpu, uint16_t addr);
+#if AGNES_SKIP_IDLE_LOOPS
+static void skip_idle_loop(cpu_t *cpu, uint16_t branch_pc, int branch_cycles);
+static bool check_idle_loop(cpu_t *cpu, uint16_t start, uint16_t branch_pc);
+static bool is_plain_memory(cpu_t *cpu, uint16_t first, uint16_t last);
+#endif
+static uint16_t cpu_read16_indirect_bug(cpu_t *cpu, uint16_t addr);
+static AGNES_ALWAYS_INLINE uint8_t get_instruction_size(addr_mode_t mode);
+static AGNES_ALWAYS_INLINE uint16_t fetch_operand(cpu_t *cpu, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE uint16_t decode_operand(addr_mode_t mode, uint16_t pc, const uint8_t *bytes);
+static AGNES_ALWAYS_INLINE const uint8_t* fetch_code(cpu_t *cpu, uint8_t *buf);
+static const uint8_t* fetch_code_slow(cpu_t *cpu, uint8_t *buf);
+static AGNES_ALWAYS_INLINE uint16_t resolve_operand(cpu_t *cpu, addr_mode_t mode, uint16_t operand, bool *out_pages_differ);
+static AGNES_ALWAYS_INLINE uint16_t get_branch_target(uint16_t pc, uint8_t offset);
+static AGNES_ALWAYS_INLINE uint8_t read_operand(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+static AGNES_ALWAYS_INLINE void write_operand(cpu_t *cpu, uint16_t addr, addr_mode_t mode, uint8_t val);
+static bool check_pages_differ(uint16_t a, uint16_t b);
+#if AGNES_BLOCK_CACHE
+static AGNES_ALWAYS_INLINE bool finish_fused_first(cpu_t *cpu, int cycles);
+#endif
+
+// Every 6502 opcode, expanded into the instruction tables, the per-opcode
+// handlers and the dispatch tables of instruction_run(). IDLE marks the ones
+// that only read, the kind skip_idle_loop() can skip.
+#define AGNES_INSTRUCTIONS(INS, INE) \
+    INS(0x00, "BRK", 7, false, false, op_brk, ADDR_MODE_IMPLIED_BRK) \
+    INS(0x01, "ORA", 6, false, true,  op_ora, ADDR_MODE_INDIRECT_X)  \
+    INE(0x02)                                                        \
+    INE(0x03)                                                        \
+    INE(0x04)                                                        \
+    INS(0x05, "ORA", 3, false, true,  op_ora, ADDR_MODE_ZERO_PAGE)   \
+    INS(0x06, "ASL", 5, false, false, op_asl, ADDR_MODE_ZERO_PAGE)   \
+    INE(0x07)                                                        \
+    INS(0x08, "PHP", 3, false, false, op_php, ADDR_MODE_IMPLIED)     \
+    INS(0x09, "ORA", 2, false, true,  op_ora, ADDR_MODE_IMMEDIATE)   \
+    INS(0x0a, "ASL", 2, false, false, op_asl, ADDR_MODE_ACCUMULATOR) \
+    INE(0x0b)                                                        \
+    INE(0x0c)                                                        \
+    INS(0x0d, "ORA", 4, false, true,  op_ora, ADDR_MODE_ABSOLUTE)    \
+    INS(0x0e, "ASL", 6, false, false, op_asl, ADDR_MODE_ABSOLUTE)    \
+    INE(0x0f)                                                        \
+    INS(0x10, "BPL", 2, true,  false, op_bpl, ADDR_MODE_RELATIVE)    \
+    INS(0x11, "ORA", 5, true,  true,  op_ora, ADDR_MODE_INDIRECT_Y)  \
+    INE(0x12)                                                        \
+    INE(0x13)                                                        \
+    INE(0x14)                                                        \
+    INS(0x15, "ORA", 4, false, true,  op_ora, ADDR_MODE_ZERO_PAGE_X) \
+    INS(0x16, "ASL", 6, false, false, op_asl, ADDR_MODE_ZERO_PAGE_X) \
+    INE(0x17)                                                        \
+    INS(0x18, "CLC", 2, false, true,  op_clc, ADDR_MODE_IMPLIED)     \
+    INS(0x19, "ORA", 4, true,  true,  op_ora, ADDR_MODE_ABSOLUTE_Y)  \
+    INE(0x1a)                                                        \
+    INE(0x1b)                                                        \
+    INE(0x1c)                                                        \
+    INS(0x1d, "ORA", 4, true,  true,  op_ora, ADDR_MODE_ABSOLUTE_X)  \
+    INS(0x1e, "ASL", 7, false, false, op_asl, ADDR_MODE_ABSOLUTE_X)  \
+    INE(0x1f)                                                        \
+    INS(0x20, "JSR", 6, false, false, op_jsr, ADDR_MODE_ABSOLUTE)    \
+    INS(0x21, "AND", 6, false, true,  op_and, ADDR_MODE_INDIRECT_X)  \
+    INE(0x22)                                                        \
+    INE(0x23)                                                        \
+    INS(0x24, "BIT", 3, false, true,  op_bit, ADDR_MODE_ZERO_PAGE)   \
+    INS(0x25, "AND", 3, false, true,  op_and, ADDR_MODE_ZERO_PAGE)   \
+    INS(0x26, "ROL", 5, false, false, op_rol, ADDR_MODE_ZERO_PAGE)   \
+    INE(0x27)                                                        \
+    INS(0x28, "PLP", 4, false, false, op_plp, ADDR_MODE_IMPLIED)     \
+    INS(0x29, "AND", 2, false, true,  op_and, ADDR_MODE_IMMEDIATE)   \
+    INS(0x2a, "ROL", 2, false, false, op_rol, ADDR_MODE_ACCUMULATOR) \
+    INE(0x2b)                                                        \
+    INS(0x2c, "BIT", 4, false, true,  op_bit, ADDR_MODE_ABSOLUTE)    \
+    INS(0x2d, "AND", 4, false, true,  op_and, ADDR_MODE_ABSOLUTE)    \
+    INS(0x2e, "ROL", 6, false, false, op_rol, ADDR_MODE_ABSOLUTE)    \
+    INE(0x2f)                                                        \
+    INS(0x30, "BMI", 2, true,  false, op_bmi, ADDR_MODE_RELATIVE)    \
+    INS(0x31, "AND", 5, true,  true,  op_and, ADDR_MODE_INDIRECT_Y)  \
+    INE(0x32)                                                        \
+    INE(0x33)                                                        \
+    INE(0x34)                                                        \
+    INS(0x35, "AND", 4, false, true,  op_and, ADDR_MODE_ZERO_PAGE_X) \
+    INS(0x36, "ROL", 6, false, false, op_rol, ADDR_MODE_ZERO_PAGE_X) \
+    INE(0x37)                                                        \
+    INS(0x38, "SEC", 2, false, true,  op_sec, ADDR_MODE_IMPLIED)     \
+    INS(0x39, "AND", 4, true,  true,  op_and, ADDR_MODE_ABSOLUTE_Y)  \
+    INE(0x3a)                                                        \
+    INE(0x3b)                                                        \
+    INE(0x3c)                                                        \
+    INS(0x3d, "AND", 4, true,  true,  op_and, ADDR_MODE_ABSOLUTE_X)  \
+    INS(0x3e, "ROL", 7, false, false, op_rol, ADDR_MODE_ABSOLUTE_X)  \
+    INE(0x3f)                                                        \
+    INS(0x40, "RTI", 6, false, false, op_rti, ADDR_MODE_IMPLIED)     \
+    INS(0x41, "EOR", 6, false, true,  op_eor, ADDR_MODE_INDIRECT_X)  \
+    INE(0x42)                                                        \
+    INE(0x43)                                                        \
+    INE(0x44)                                                        \
+    INS(0x45, "EOR", 3, false, true,  op_eor, ADDR_MODE_ZERO_PAGE)   \
+    INS(0x46, "LSR", 5, false, false, op_lsr, ADDR_MODE_ZERO_PAGE)   \
+    INE(0x47)                                                        \
+    INS(0x48, "PHA", 3, false, false, op_pha, ADDR_MODE_IMPLIED)     \
+    INS(0x49, "EOR", 2, false, true,  op_eor, ADDR_MODE_IMMEDIATE)   \
+    INS(0x4a, "LSR", 2, false, false, op_lsr, ADDR_MODE_ACCUMULATOR) \
+    INE(0x4b)                                                        \
+    INS(0x4c, "JMP", 3, false, false, op_jmp, ADDR_MODE_ABSOLUTE)    \
+    INS(0x4d, "EOR", 4, false, true,  op_eor, ADDR_MODE_ABSOLUTE)    \
+    INS(0x4e, "LSR", 6, false, false, op_lsr, ADDR_MODE_ABSOLUTE)    \
+    INE(0x4f)                                                        \
+    INS(0x50, "BVC", 2, true,  false, op_bvc, ADDR_MODE_RELATIVE)    \
+    INS(0x51, "EOR", 5, true,  true,  op_eor, ADDR_MODE_INDIRECT_Y)  \
+    INE(0x52)                                                        \
+    INE(0x53)                                                        \
+    INE(0x54)                                                        \
+    INS(0x55, "EOR", 4, false, true,  op_eor, ADDR_MODE_ZERO_PAGE_X) \
+    INS(0x56, "LSR", 6, false, false, op_lsr, ADDR_MODE_ZERO_PAGE_X) \
+    INE(0x57)                                                        \
+    INS(0x58, "CLI", 2, false, false, op_cli, ADDR_MODE_IMPLIED)     \
+    INS(0x59, "EOR", 4, true,  true,  op_eor, ADDR_MODE_ABSOLUTE_Y)  \
+    INE(0x5a)                                                        \
+    INE(0x5b)                                                        \
+    INE(0x5c)                                                        \
+    INS(0x5d, "EOR", 4, true,  true,  op_eor, ADDR_MODE_ABSOLUTE_X)  \
+    INS(0x5e, "LSR", 7, false, false, op_lsr, ADDR_MODE_ABSOLUTE_X)  \
+    INE(0x5f)                                                        \
+    INS(0x60, "RTS", 6, false, false, op_rts, ADDR_MODE_IMPLIED)     \
+    INS(0x61, "ADC", 6, false, true,  op_adc, ADDR_MODE_INDIRECT_X)  \
+    INE(0x62)                                                        \
+    INE(0x63)                                                        \
+    INE(0x64)                                                        \
+    INS(0x65, "ADC", 3, false, true,  op_adc, ADDR_MODE_ZERO_PAGE)   \
+    INS(0x66, "ROR", 5, false, false, op_ror, ADDR_MODE_ZERO_PAGE)   \
+    INE(0x67)                                                        \
+    INS(0x68, "PLA", 4, false, false, op_pla, ADDR_MODE_IMPLIED)     \
+    INS(0x69, "ADC", 2, false, true,  op_adc, ADDR_MODE_IMMEDIATE)   \
+    INS(0x6a, "ROR", 2, false, false, op_ror, ADDR_MODE_ACCUMULATOR) \
+    INE(0x6b)                                                        \
+    INS(0x6c, "JMP", 5, false, false, op_jmp, ADDR_MODE_INDIRECT)    \
+    INS(0x6d, "ADC", 4, false, true,  op_adc, ADDR_MODE_ABSOLUTE)    \
+    INS(0x6e, "ROR", 6, false, false, op_ror, ADDR_MODE_ABSOLUTE)    \
+    INE(0x6f)                                                        \
+    INS(0x70, "BVS", 2, true,  false, op_bvs, ADDR_MODE_RELATIVE)    \
+    INS(0x71, "ADC", 5, true,  true,  op_adc, ADDR_MODE_INDIRECT_Y)  \
+    INE(0x72)                                                        \
+    INE(0x73)                                                        \
+    INE(0x74)                                                        \
+    INS(0x75, "ADC", 4, false, true,  op_adc, ADDR_MODE_ZERO_PAGE_X) \
+    INS(0x76, "ROR", 6, false, false, op_ror, ADDR_MODE_ZERO_PAGE_X) \
+    INE(0x77)                                                        \
+    INS(0x78, "SEI", 2, false, false, op_sei, ADDR_MODE_IMPLIED)     \
+    INS(0x79, "ADC", 4, true,  true,  op_adc, ADDR_MODE_ABSOLUTE_Y)  \
+    INE(0x7a)                                                        \
+    INE(0x7b)                                                        \
+    INE(0x7c)                                                        \
+    INS(0x7d, "ADC", 4, true,  true,  op_adc, ADDR_MODE_ABSOLUTE_X)  \
+    INS(0x7e, "ROR", 7, false, false, op_ror, ADDR_MODE_ABSOLUTE_X)  \
+    INE(0x7f)                                                        \
+    INE(0x80)                                                        \
+    INS(0x81, "STA", 6, false, false, op_sta, ADDR_MODE_INDIRECT_X)  \
+    INE(0x82)                                                        \
+    INE(0x83)                                                        \
+    INS(0x84, "STY", 3, false, false, op_sty, ADDR_MODE_ZERO_PAGE)   \
+    INS(0x85, "STA", 3, false, false, op_sta, ADDR_MODE_ZERO_PAGE)   \
+    INS(0x86, "STX", 3, false, false, op_stx, ADDR_MODE_ZERO_PAGE)   \
+    INE(0x87)                                                        \
+    INS(0x88, "DEY", 2, false, false, op_dey, ADDR_MODE_IMPLIED)     \
+    INE(0x89)                                                        \
+    INS(0x8a, "TXA", 2, false, true,  op_txa, ADDR_MODE_IMPLIED)     \
+    INE(0x8b)                                                        \
+    INS(0x8c, "STY", 4, false, false, op_sty, ADDR_MODE_ABSOLUTE)    \
+    INS(0x8d, "STA", 4, false, false, op_sta, ADDR_MODE_ABSOLUTE)    \
+    INS(0x8e, "STX", 4, false, false, op_stx, ADDR_MODE_ABSOLUTE)    \
+    INE(0x8f)                                                        \
+    INS(0x90, "BCC", 2, true,  false, op_bcc, ADDR_MODE_RELATIVE)    \
+    INS(0x91, "STA", 6, false, false, op_sta, ADDR_MODE_INDIRECT_Y)  \
+    INE(0x92)                                                        \
+    INE(0x93)                                                        \
+    INS(0x94, "STY", 4, false, false, op_sty, ADDR_MODE_ZERO_PAGE_X) \
+    INS(0x95, "STA", 4, false, false, op_sta, ADDR_MODE_ZERO_PAGE_X) \
+    INS(0x96, "STX", 4, false, false, op_stx, ADDR_MODE_ZERO_PAGE_Y) \
+    INE(0x97)                                                        \
+    INS(0x98, "TYA", 2, false, true,  op_tya, ADDR_MODE_IMPLIED)     \
+    INS(0x99, "STA", 5, false, false, op_sta, ADDR_MODE_ABSOLUTE_Y)  \
+    INS(0x9a, "TXS", 2, false, false, op_txs, ADDR_MODE_IMPLIED)     \
+    INE(0x9b)                                                        \
+    INE(0x9c)                                                        \
+    INS(0x9d, "STA", 5, false, false, op_sta, ADDR_MODE_ABSOLUTE_X)  \
+    INE(0x9e)                                                        \
+    INE(0x9f)                                                        \
+    INS(0xa0, "LDY", 2, false, true,  op_ldy, ADDR_MODE_IMMEDIATE)   \
+    INS(0xa1, "LDA", 6, false, true,  op_lda, ADDR_MODE_INDIRECT_X)  \
+    INS(0xa2, "LDX", 2, false, true,  op_ldx, ADDR_MODE_IMMEDIATE)   \
+    INE(0xa3)                                                        \
+    INS(0xa4, "LDY", 3, false, true,  op_ldy, ADDR_MODE_ZERO_PAGE)   \
+    INS(0xa5, "LDA", 3, false, true,  op_lda, ADDR_MODE_ZERO_PAGE)   \
+    INS(0xa6, "LDX", 3, false, true,  op_ldx, ADDR_MODE_ZERO_PAGE)   \
+    INE(0xa7)                                                        \
+    INS(0xa8, "TAY", 2, false, true,  op_tay, ADDR_MODE_IMPLIED)     \
+    INS(0xa9, "LDA", 2, false, true,  op_lda, ADDR_MODE_IMMEDIATE)   \
+    INS(0xaa, "TAX", 2, false, true,  op_tax, ADDR_MODE_IMPLIED)     \
+    INE(0xab)                                                        \
+    INS(0xac, "LDY", 4, false, true,  op_ldy, ADDR_MODE_ABSOLUTE)    \
+    INS(0xad, "LDA", 4, false, true,  op_lda, ADDR_MODE_ABSOLUTE)    \
+    INS(0xae, "LDX", 4, false, true,  op_ldx, ADDR_MODE_ABSOLUTE)    \
+    INE(0xaf)                                                        \
+    INS(0xb0, "BCS", 2, true,  false, op_bcs, ADDR_MODE_RELATIVE)    \
+    INS(0xb1, "LDA", 5, true,  true,  op_lda, ADDR_MODE_INDIRECT_Y)  \
+    INE(0xb2)                                                        \
+    INE(0xb3)                                                        \
+    INS(0xb4, "LDY", 4, false, true,  op_ldy, ADDR_MODE_ZERO_PAGE_X) \
+    INS(0xb5, "LDA", 4, false, true,  op_lda, ADDR_MODE_ZERO_PAGE_X) \
+    INS(0xb6, "LDX", 4, false, true,  op_ldx, ADDR_MODE_ZERO_PAGE_Y) \
+    INE(0xb7)                                                        \
+    INS(0xb8, "CLV", 2, false, true,  op_clv, ADDR_MODE_IMPLIED)     \
+    INS(0xb9, "LDA", 4, true,  true,  op_lda, ADDR_MODE_ABSOLUTE_Y)  \
+    INS(0xba, "TSX", 2, false, false, op_tsx, ADDR_MODE_IMPLIED)     \
+    INE(0xbb)                                                        \
+    INS(0xbc, "LDY", 4, true,  true,  op_ldy, ADDR_MODE_ABSOLUTE_X)  \
+    INS(0xbd, "LDA", 4, true,  true,  op_lda, ADDR_MODE_ABSOLUTE_X)  \
+    INS(0xbe, "LDX", 4, true,  true,  op_ldx, ADDR_MODE_ABSOLUTE_Y)  \
+    INE(0xbf)                                                        \
+    INS(0xc0, "CPY", 2, false, true,  op_cpy, ADDR_MODE_IMMEDIATE)   \
+    INS(0xc1, "CMP", 6, false, true,  op_cmp, ADDR_MODE_INDIRECT_X)  \
+    INE(0xc2)                                                        \
+    INE(0xc3)                                                        \
+    INS(0xc4, "CPY", 3, false, true,  op_cpy, ADDR_MODE_ZERO_PAGE)   \
+    INS(0xc5, "CMP", 3, false, true,  op_cmp, ADDR_MODE_ZERO_PAGE)   \
+    INS(0xc6, "DEC", 5, false, false, op_dec, ADDR_MODE_ZERO_PAGE)   \
+    INE(0xc7)                                                        \
+    INS(0xc8, "INY", 2, false, false, op_iny, ADDR_MODE_IMPLIED)     \
+    INS(0xc9, "CMP", 2, false, true,  op_cmp, ADDR_MODE_IMMEDIATE)   \
+    INS(0xca, "DEX", 2, false, false, op_dex, ADDR_MODE_IMPLIED)     \
+    INE(0xcb)                                                        \
+    INS(0xcc, "CPY", 4, false, true,  op_cpy, ADDR_MODE_ABSOLUTE)    \
+    INS(0xcd, "CMP", 4, false, true,  op_cmp, ADDR_MODE_ABSOLUTE)    \
+    INS(0xce, "DEC", 6, false, false, op_dec, ADDR_MODE_ABSOLUTE)    \
+    INE(0xcf)                                                        \
+    INS(0xd0, "BNE", 2, true,  false, op_bne, ADDR_MODE_RELATIVE)    \
+    INS(0xd1, "CMP", 5, true,  true,  op_cmp, ADDR_MODE_INDIRECT_Y)  \
+    INE(0xd2)                                                        \
+    INE(0xd3)                                                        \
+    INE(0xd4)                                                        \
+    INS(0xd5, "CMP", 4, false, true,  op_cmp, ADDR_MODE_ZERO_PAGE_X) \
+    INS(0xd6, "DEC", 6, false, false, op_dec, ADDR_MODE_ZERO_PAGE_X) \
+    INE(0xd7)                                                        \
+    INS(0xd8, "CLD", 2, false, false, op_cld, ADDR_MODE_IMPLIED)     \
+    INS(0xd9, "CMP", 4, true,  true,  op_cmp, ADDR_MODE_ABSOLUTE_Y)  \
+    INE(0xda)                                                        \
+    INE(0xdb)                                                        \
+    INE(0xdc)                                                        \
+    INS(0xdd, "CMP", 4, true,  true,  op_cmp, ADDR_MODE_ABSOLUTE_X)  \
+    INS(0xde, "DEC", 7, false, false, op_dec, ADDR_MODE_ABSOLUTE_X)  \
+    INE(0xdf)                                                        \
+    INS(0xe0, "CPX", 2, false, true,  op_cpx, ADDR_MODE_IMMEDIATE)   \
+    INS(0xe1, "SBC", 6, false, true,  op_sbc, ADDR_MODE_INDIRECT_X)  \
+    INE(0xe2)                                                        \
+    INE(0xe3)                                                        \
+    INS(0xe4, "CPX", 3, false, true,  op_cpx, ADDR_MODE_ZERO_PAGE)   \
+    INS(0xe5, "SBC", 3, false, true,  op_sbc, ADDR_MODE_ZERO_PAGE)   \
+    INS(0xe6, "INC", 5, false, false, op_inc, ADDR_MODE_ZERO_PAGE)   \
+    INE(0xe7)                                                        \
+    INS(0xe8, "INX", 2, false, false, op_inx, ADDR_MODE_IMPLIED)     \
+    INS(0xe9, "SBC", 2, false, true,  op_sbc, ADDR_MODE_IMMEDIATE)   \
+    INS(0xea, "NOP", 2, false, true,  op_nop, ADDR_MODE_IMPLIED)     \
+    INE(0xeb)                                                        \
+    INS(0xec, "CPX", 4, false, true,  op_cpx, ADDR_MODE_ABSOLUTE)    \
+    INS(0xed, "SBC", 4, false, true,  op_sbc, ADDR_MODE_ABSOLUTE)    \
+    INS(0xee, "INC", 6, false, false, op_inc, ADDR_MODE_ABSOLUTE)    \
+    INE(0xef)                                                        \
+    INS(0xf0, "BEQ", 2, true,  false, op_beq, ADDR_MODE_RELATIVE)    \
+    INS(0xf1, "SBC", 5, true,  true,  op_sbc, ADDR_MODE_INDIRECT_Y)  \
+    INE(0xf2)                                                        \
+    INE(0xf3)                                                        \
+    INE(0xf4)                                                        \
+    INS(0xf5, "SBC", 4, false, true,  op_sbc, ADDR_MODE_ZERO_PAGE_X) \
+    INS(0xf6, "INC", 6, false, false, op_inc, ADDR_MODE_ZERO_PAGE_X) \
+    INE(0xf7)                                                        \
+    INS(0xf8, "SED", 2, false, false, op_sed, ADDR_MODE_IMPLIED)     \
+    INS(0xf9, "SBC", 4, true,  true,  op_sbc, ADDR_MODE_ABSOLUTE_Y)  \
+    INE(0xfa)                                                        \
+    INE(0xfb)                                                        \
+    INE(0xfc)                                                        \
+    INS(0xfd, "SBC", 4, true,  true,  op_sbc, ADDR_MODE_ABSOLUTE_X)  \
+    INS(0xfe, "INC", 7, false, false, op_inc, ADDR_MODE_ABSOLUTE_X)  \
+    INE(0xff)
+
+#define INS(OPC, NAME, CYCLES, PCC, IDLE, OP, MODE) \
+    static AGNES_ALWAYS_INLINE int run_##OPC(cpu_t *cpu, uint16_t operand); \
+    static int ins_##OPC(cpu_t *cpu);
+#define INE(OPC)
+AGNES_INSTRUCTIONS(INS, INE)
+#undef INE
+#undef INS
 
-#define INS(OPC, NAME, CYCLES, PCC, OP, MODE) { NAME, OPC, CYCLES, PCC, MODE, OP }
-#define INE(OPC) { "ILL", OPC, 1, false, ADDR_MODE_IMPLIED, NULL }
+#if AGNES_BLOCK_CACHE
+#define INS(OPC, NAME, CYCLES, PCC, IDLE, OP, MODE) static int decoded_##OPC(cpu_t *cpu, uint32_t operands);
+#define INE(OPC)
+AGNES_INSTRUCTIONS(INS, INE)
+#undef INE
+#undef INS
+#endif
+
+#define INS(OPC, NAME, CYCLES, PCC, IDLE, OP, MODE) { CYCLES, PCC, ins_##OPC },
+#define INE(OPC) { 1, false, NULL },
+
+// Only what the interpreter touches on every instruction
+static instruction_exec_t instruction_execs[256] = {
+    AGNES_INSTRUCTIONS(INS, INE)
+};
+
+#undef INE
+#undef INS
+
+#if AGNES_BLOCK_CACHE
+#define INS(OPC, NAME, CYCLES, PCC, IDLE, OP, MODE) { NAME, OPC, MODE, decoded_##OPC },
+#define INE(OPC) { "ILL", OPC, ADDR_MODE_IMPLIED, NULL },
+#else
+#define INS(OPC, NAME, CYCLES, PCC, IDLE, OP, MODE) { NAME, OPC, MODE },
+#define INE(OPC) { "ILL", OPC, ADDR_MODE_IMPLIED },
+#endif
 
 static instruction_t instructions[256] = {
-    INS(0x00, "BRK", 7, false, op_brk, ADDR_MODE_IMPLIED_BRK),
-    INS(0x01, "ORA", 6, false, op_ora, ADDR_MODE_INDIRECT_X),
-    INE(0x02),
-    INE(0x03),
-    INE(0x04),
-    INS(0x05, "ORA", 3, false, op_ora, ADDR_MODE_ZERO_PAGE),
-    INS(0x06, "ASL", 5, false, op_asl, ADDR_MODE_ZERO_PAGE),
-    INE(0x07),
-    INS(0x08, "PHP", 3, false, op_php, ADDR_MODE_IMPLIED),
-    INS(0x09, "ORA", 2, false, op_ora, ADDR_MODE_IMMEDIATE),
-    INS(0x0a, "ASL", 2, false, op_asl, ADDR_MODE_ACCUMULATOR),
-    INE(0x0b),
-    INE(0x0c),
-    INS(0x0d, "ORA", 4, false, op_ora, ADDR_MODE_ABSOLUTE),
-    INS(0x0e, "ASL", 6, false, op_asl, ADDR_MODE_ABSOLUTE),
-    INE(0x0f),
-    INS(0x10, "BPL", 2, true,  op_bpl, ADDR_MODE_RELATIVE),
-    INS(0x11, "ORA", 5, true,  op_ora, ADDR_MODE_INDIRECT_Y),
-    INE(0x12),
-    INE(0x13),
-    INE(0x14),
-    INS(0x15, "ORA", 4, false, op_ora, ADDR_MODE_ZERO_PAGE_X),
-    INS(0x16, "ASL", 6, false, op_asl, ADDR_MODE_ZERO_PAGE_X),
-    INE(0x17),
-    INS(0x18, "CLC", 2, false, op_clc, ADDR_MODE_IMPLIED),
-    INS(0x19, "ORA", 4, true,  op_ora, ADDR_MODE_ABSOLUTE_Y),
-    INE(0x1a),
-    INE(0x1b),
-    INE(0x1c),
-    INS(0x1d, "ORA", 4, true,  op_ora, ADDR_MODE_ABSOLUTE_X),
-    INS(0x1e, "ASL", 7, false, op_asl, ADDR_MODE_ABSOLUTE_X),
-    INE(0x1f),
-    INS(0x20, "JSR", 6, false, op_jsr, ADDR_MODE_ABSOLUTE),
-    INS(0x21, "AND", 6, false, op_and, ADDR_MODE_INDIRECT_X),
-    INE(0x22),
-    INE(0x23),
-    INS(0x24, "BIT", 3, false, op_bit, ADDR_MODE_ZERO_PAGE),
-    INS(0x25, "AND", 3, false, op_and, ADDR_MODE_ZERO_PAGE),
-    INS(0x26, "ROL", 5, false, op_rol, ADDR_MODE_ZERO_PAGE),
-    INE(0x27),
-    INS(0x28, "PLP", 4, false, op_plp, ADDR_MODE_IMPLIED),
-    INS(0x29, "AND", 2, false, op_and, ADDR_MODE_IMMEDIATE),
-    INS(0x2a, "ROL", 2, false, op_rol, ADDR_MODE_ACCUMULATOR),
-    INE(0x2b),
-    INS(0x2c, "BIT", 4, false, op_bit, ADDR_MODE_ABSOLUTE),
-    INS(0x2d, "AND", 4, false, op_and, ADDR_MODE_ABSOLUTE),
-    INS(0x2e, "ROL", 6, false, op_rol, ADDR_MODE_ABSOLUTE),
-    INE(0x2f),
-    INS(0x30, "BMI", 2, true,  op_bmi, ADDR_MODE_RELATIVE),
-    INS(0x31, "AND", 5, true,  op_and, ADDR_MODE_INDIRECT_Y),
-    INE(0x32),
-    INE(0x33),
-    INE(0x34),
-    INS(0x35, "AND", 4, false, op_and, ADDR_MODE_ZERO_PAGE_X),
-    INS(0x36, "ROL", 6, false, op_rol, ADDR_MODE_ZERO_PAGE_X),
-    INE(0x37),
-    INS(0x38, "SEC", 2, false, op_sec, ADDR_MODE_IMPLIED),
-    INS(0x39, "AND", 4, true,  op_and, ADDR_MODE_ABSOLUTE_Y),
-    INE(0x3a),
-    INE(0x3b),
-    INE(0x3c),
-    INS(0x3d, "AND", 4, true,  op_and, ADDR_MODE_ABSOLUTE_X),
-    INS(0x3e, "ROL", 7, false, op_rol, ADDR_MODE_ABSOLUTE_X),
-    INE(0x3f),
-    INS(0x40, "RTI", 6, false, op_rti, ADDR_MODE_IMPLIED),
-    INS(0x41, "EOR", 6, false, op_eor, ADDR_MODE_INDIRECT_X),
-    INE(0x42),
-    INE(0x43),
-    INE(0x44),
-    INS(0x45, "EOR", 3, false, op_eor, ADDR_MODE_ZERO_PAGE),
-    INS(0x46, "LSR", 5, false, op_lsr, ADDR_MODE_ZERO_PAGE),
-    INE(0x47),
-    INS(0x48, "PHA", 3, false, op_pha, ADDR_MODE_IMPLIED),
-    INS(0x49, "EOR", 2, false, op_eor, ADDR_MODE_IMMEDIATE),
-    INS(0x4a, "LSR", 2, false, op_lsr, ADDR_MODE_ACCUMULATOR),
-    INE(0x4b),
-    INS(0x4c, "JMP", 3, false, op_jmp, ADDR_MODE_ABSOLUTE),
-    INS(0x4d, "EOR", 4, false, op_eor, ADDR_MODE_ABSOLUTE),
-    INS(0x4e, "LSR", 6, false, op_lsr, ADDR_MODE_ABSOLUTE),
-    INE(0x4f),
-    INS(0x50, "BVC", 2, true,  op_bvc, ADDR_MODE_RELATIVE),
-    INS(0x51, "EOR", 5, true,  op_eor, ADDR_MODE_INDIRECT_Y),
-    INE(0x52),
-    INE(0x53),
-    INE(0x54),
-    INS(0x55, "EOR", 4, false, op_eor, ADDR_MODE_ZERO_PAGE_X),
-    INS(0x56, "LSR", 6, false, op_lsr, ADDR_MODE_ZERO_PAGE_X),
-    INE(0x57),
-    INS(0x58, "CLI", 2, false, op_cli, ADDR_MODE_IMPLIED),
-    INS(0x59, "EOR", 4, true,  op_eor, ADDR_MODE_ABSOLUTE_Y),
-    INE(0x5a),
-    INE(0x5b),
-    INE(0x5c),
-    INS(0x5d, "EOR", 4, true,  op_eor, ADDR_MODE_ABSOLUTE_X),
-    INS(0x5e, "LSR", 7, false, op_lsr, ADDR_MODE_ABSOLUTE_X),
-    INE(0x5f),
-    INS(0x60, "RTS", 6, false, op_rts, ADDR_MODE_IMPLIED),
-    INS(0x61, "ADC", 6, false, op_adc, ADDR_MODE_INDIRECT_X),
-    INE(0x62),
-    INE(0x63),
-    INE(0x64),
-    INS(0x65, "ADC", 3, false, op_adc, ADDR_MODE_ZERO_PAGE),
-    INS(0x66, "ROR", 5, false, op_ror, ADDR_MODE_ZERO_PAGE),
-    INE(0x67),
-    INS(0x68, "PLA", 4, false, op_pla, ADDR_MODE_IMPLIED),
-    INS(0x69, "ADC", 2, false, op_adc, ADDR_MODE_IMMEDIATE),
-    INS(0x6a, "ROR", 2, false, op_ror, ADDR_MODE_ACCUMULATOR),
-    INE(0x6b),
-    INS(0x6c, "JMP", 5, false, op_jmp, ADDR_MODE_INDIRECT),
-    INS(0x6d, "ADC", 4, false,  op_adc, ADDR_MODE_ABSOLUTE),
-    INS(0x6e, "ROR", 6, false, op_ror, ADDR_MODE_ABSOLUTE),
-    INE(0x6f),
-    INS(0x70, "BVS", 2, true,  op_bvs, ADDR_MODE_RELATIVE),
-    INS(0x71, "ADC", 5, true,  op_adc, ADDR_MODE_INDIRECT_Y),
-    INE(0x72),
-    INE(0x73),
-    INE(0x74),
-    INS(0x75, "ADC", 4, false, op_adc, ADDR_MODE_ZERO_PAGE_X),
-    INS(0x76, "ROR", 6, false, op_ror, ADDR_MODE_ZERO_PAGE_X),
-    INE(0x77),
-    INS(0x78, "SEI", 2, false, op_sei, ADDR_MODE_IMPLIED),
-    INS(0x79, "ADC", 4, true,  op_adc, ADDR_MODE_ABSOLUTE_Y),
-    INE(0x7a),
-    INE(0x7b),
-    INE(0x7c),
-    INS(0x7d, "ADC", 4, true,  op_adc, ADDR_MODE_ABSOLUTE_X),
-    INS(0x7e, "ROR", 7, false, op_ror, ADDR_MODE_ABSOLUTE_X),
-    INE(0x7f),
-    INE(0x80),
-    INS(0x81, "STA", 6, false, op_sta, ADDR_MODE_INDIRECT_X),
-    INE(0x82),
-    INE(0x83),
-    INS(0x84, "STY", 3, false, op_sty, ADDR_MODE_ZERO_PAGE),
-    INS(0x85, "STA", 3, false, op_sta, ADDR_MODE_ZERO_PAGE),
-    INS(0x86, "STX", 3, false, op_stx, ADDR_MODE_ZERO_PAGE),
-    INE(0x87),
-    INS(0x88, "DEY", 2, false, op_dey, ADDR_MODE_IMPLIED),
-    INE(0x89),
-    INS(0x8a, "TXA", 2, false, op_txa, ADDR_MODE_IMPLIED),
-    INE(0x8b),
-    INS(0x8c, "STY", 4, false, op_sty, ADDR_MODE_ABSOLUTE),
-    INS(0x8d, "STA", 4, false, op_sta, ADDR_MODE_ABSOLUTE),
-    INS(0x8e, "STX", 4, false, op_stx, ADDR_MODE_ABSOLUTE),
-    INE(0x8f),
-    INS(0x90, "BCC", 2, true,  op_bcc, ADDR_MODE_RELATIVE),
-    INS(0x91, "STA", 6, false, op_sta, ADDR_MODE_INDIRECT_Y),
-    INE(0x92),
-    INE(0x93),
-    INS(0x94, "STY", 4, false, op_sty, ADDR_MODE_ZERO_PAGE_X),
-    INS(0x95, "STA", 4, false, op_sta, ADDR_MODE_ZERO_PAGE_X),
-    INS(0x96, "STX", 4, false, op_stx, ADDR_MODE_ZERO_PAGE_Y),
-    INE(0x97),
-    INS(0x98, "TYA", 2, false, op_tya, ADDR_MODE_IMPLIED),
-    INS(0x99, "STA", 5, false, op_sta, ADDR_MODE_ABSOLUTE_Y),
-    INS(0x9a, "TXS", 2, false, op_txs, ADDR_MODE_IMPLIED),
-    INE(0x9b),
-    INE(0x9c),
-    INS(0x9d, "STA", 5, false, op_sta, ADDR_MODE_ABSOLUTE_X),
-    INE(0x9e),
-    INE(0x9f),
-    INS(0xa0, "LDY", 2, false, op_ldy, ADDR_MODE_IMMEDIATE),
-    INS(0xa1, "LDA", 6, false, op_lda, ADDR_MODE_INDIRECT_X),
-    INS(0xa2, "LDX", 2, false, op_ldx, ADDR_MODE_IMMEDIATE),
-    INE(0xa3),
-    INS(0xa4, "LDY", 3, false, op_ldy, ADDR_MODE_ZERO_PAGE),
-    INS(0xa5, "LDA", 3, false, op_lda, ADDR_MODE_ZERO_PAGE),
-    INS(0xa6, "LDX", 3, false, op_ldx, ADDR_MODE_ZERO_PAGE),
-    INE(0xa7),
-    INS(0xa8, "TAY", 2, false, op_tay, ADDR_MODE_IMPLIED),
-    INS(0xa9, "LDA", 2, false, op_lda, ADDR_MODE_IMMEDIATE),
-    INS(0xaa, "TAX", 2, false, op_tax, ADDR_MODE_IMPLIED),
-    INE(0xab),
-    INS(0xac, "LDY", 4, false, op_ldy, ADDR_MODE_ABSOLUTE),
-    INS(0xad, "LDA", 4, false, op_lda, ADDR_MODE_ABSOLUTE),
-    INS(0xae, "LDX", 4, false, op_ldx, ADDR_MODE_ABSOLUTE),
-    INE(0xaf),
-    INS(0xb0, "BCS", 2, true,  op_bcs, ADDR_MODE_RELATIVE),
-    INS(0xb1, "LDA", 5, true,  op_lda, ADDR_MODE_INDIRECT_Y),
-    INE(0xb2),
-    INE(0xb3),
-    INS(0xb4, "LDY", 4, false, op_ldy, ADDR_MODE_ZERO_PAGE_X),
-    INS(0xb5, "LDA", 4, false, op_lda, ADDR_MODE_ZERO_PAGE_X),
-    INS(0xb6, "LDX", 4, false, op_ldx, ADDR_MODE_ZERO_PAGE_Y),
-    INE(0xb7),
-    INS(0xb8, "CLV", 2, false, op_clv, ADDR_MODE_IMPLIED),
-    INS(0xb9, "LDA", 4, true,  op_lda, ADDR_MODE_ABSOLUTE_Y),
-    INS(0xba, "TSX", 2, false, op_tsx, ADDR_MODE_IMPLIED),
-    INE(0xbb),
-    INS(0xbc, "LDY", 4, true,  op_ldy, ADDR_MODE_ABSOLUTE_X),
-    INS(0xbd, "LDA", 4, true,  op_lda, ADDR_MODE_ABSOLUTE_X),
-    INS(0xbe, "LDX", 4, true,  op_ldx, ADDR_MODE_ABSOLUTE_Y),
-    INE(0xbf),
-    INS(0xc0, "CPY", 2, false, op_cpy, ADDR_MODE_IMMEDIATE),
-    INS(0xc1, "CMP", 6, false, op_cmp, ADDR_MODE_INDIRECT_X),
-    INE(0xc2),
-    INE(0xc3),
-    INS(0xc4, "CPY", 3, false, op_cpy, ADDR_MODE_ZERO_PAGE),
-    INS(0xc5, "CMP", 3, false, op_cmp, ADDR_MODE_ZERO_PAGE),
-    INS(0xc6, "DEC", 5, false, op_dec, ADDR_MODE_ZERO_PAGE),
-    INE(0xc7),
-    INS(0xc8, "INY", 2, false, op_iny, ADDR_MODE_IMPLIED),
-    INS(0xc9, "CMP", 2, false, op_cmp, ADDR_MODE_IMMEDIATE),
-    INS(0xca, "DEX", 2, false, op_dex, ADDR_MODE_IMPLIED),
-    INE(0xcb),
-    INS(0xcc, "CPY", 4, false, op_cpy, ADDR_MODE_ABSOLUTE),
-    INS(0xcd, "CMP", 4, false, op_cmp, ADDR_MODE_ABSOLUTE),
-    INS(0xce, "DEC", 6, false, op_dec, ADDR_MODE_ABSOLUTE),
-    INE(0xcf),
-    INS(0xd0, "BNE", 2, true,  op_bne, ADDR_MODE_RELATIVE),
-    INS(0xd1, "CMP", 5, true,  op_cmp, ADDR_MODE_INDIRECT_Y),
-    INE(0xd2),
-    INE(0xd3),
-    INE(0xd4),
-    INS(0xd5, "CMP", 4, false, op_cmp, ADDR_MODE_ZERO_PAGE_X),
-    INS(0xd6, "DEC", 6, false, op_dec, ADDR_MODE_ZERO_PAGE_X),
-    INE(0xd7),
-    INS(0xd8, "CLD", 2, false, op_cld, ADDR_MODE_IMPLIED),
-    INS(0xd9, "CMP", 4, true,  op_cmp, ADDR_MODE_ABSOLUTE_Y),
-    INE(0xda),
-    INE(0xdb),
-    INE(0xdc),
-    INS(0xdd, "CMP", 4, true,  op_cmp, ADDR_MODE_ABSOLUTE_X),
-    INS(0xde, "DEC", 7, false, op_dec, ADDR_MODE_ABSOLUTE_X),
-    INE(0xdf),
-    INS(0xe0, "CPX", 2, false, op_cpx, ADDR_MODE_IMMEDIATE),
-    INS(0xe1, "SBC", 6, false, op_sbc, ADDR_MODE_INDIRECT_X),
-    INE(0xe2),
-    INE(0xe3),
-    INS(0xe4, "CPX", 3, false, op_cpx, ADDR_MODE_ZERO_PAGE),
-    INS(0xe5, "SBC", 3, false, op_sbc, ADDR_MODE_ZERO_PAGE),
-    INS(0xe6, "INC", 5, false, op_inc, ADDR_MODE_ZERO_PAGE),
-    INE(0xe7),
-    INS(0xe8, "INX", 2, false, op_inx, ADDR_MODE_IMPLIED),
-    INS(0xe9, "SBC", 2, false, op_sbc, ADDR_MODE_IMMEDIATE),
-    INS(0xea, "NOP", 2, false, op_nop, ADDR_MODE_IMPLIED),
-    INE(0xeb),
-    INS(0xec, "CPX", 4, false, op_cpx, ADDR_MODE_ABSOLUTE),
-    INS(0xed, "SBC", 4, false, op_sbc, ADDR_MODE_ABSOLUTE),
-    INS(0xee, "INC", 6, false, op_inc, ADDR_MODE_ABSOLUTE),
-    INE(0xef),
-    INS(0xf0, "BEQ", 2, true,  op_beq, ADDR_MODE_RELATIVE),
-    INS(0xf1, "SBC", 5, true,  op_sbc, ADDR_MODE_INDIRECT_Y),
-    INE(0xf2),
-    INE(0xf3),
-    INE(0xf4),
-    INS(0xf5, "SBC", 4, false, op_sbc, ADDR_MODE_ZERO_PAGE_X),
-    INS(0xf6, "INC", 6, false, op_inc, ADDR_MODE_ZERO_PAGE_X),
-    INE(0xf7),
-    INS(0xf8, "SED", 2, false, op_sed, ADDR_MODE_IMPLIED),
-    INS(0xf9, "SBC", 4, true,  op_sbc, ADDR_MODE_ABSOLUTE_Y),
-    INE(0xfa),
-    INE(0xfb),
-    INE(0xfc),
-    INS(0xfd, "SBC", 4, true,  op_sbc, ADDR_MODE_ABSOLUTE_X),
-    INS(0xfe, "INC", 7, false, op_inc, ADDR_MODE_ABSOLUTE_X),
-    INE(0xff),
+    AGNES_INSTRUCTIONS(INS, INE)
 };
 
 #undef INE
 #undef INS
 
+#if AGNES_SKIP_IDLE_LOOPS
+#define INS(OPC, NAME, CYCLES, PCC, IDLE, OP, MODE) IDLE,
+#define INE(OPC) false,
+
+// Looked up by check_idle_loop()
+static const bool instruction_idle_safe[256] = {
+    AGNES_INSTRUCTIONS(INS, INE)
+};
+
+#undef INE
+#undef INS
+#endif
+
 instruction_t* instruction_get(uint8_t opc) {
     return &instructions[opc];
 }
 
+instruction_exec_t* instruction_get_exec(uint8_t opc) {
+    return &instruction_execs[opc];
+}
+
 uint8_t instruction_get_size(addr_mode_t mode) {
-    switch (mode) {
-        case ADDR_MODE_NONE:        return 0;
-        case ADDR_MODE_ABSOLUTE:    return 3;
-        case ADDR_MODE_ABSOLUTE_X:  return 3;
-        case ADDR_MODE_ABSOLUTE_Y:  return 3;
-        case ADDR_MODE_ACCUMULATOR: return 1;
-        case ADDR_MODE_IMMEDIATE:   return 2;
-        case ADDR_MODE_IMPLIED:     return 1;
-        case ADDR_MODE_IMPLIED_BRK: return 2;
-        case ADDR_MODE_INDIRECT:    return 3;
-        case ADDR_MODE_INDIRECT_X:  return 2;
-        case ADDR_MODE_INDIRECT_Y:  return 2;
-        case ADDR_MODE_RELATIVE:    return 2;
-        case ADDR_MODE_ZERO_PAGE:   return 2;
-        case ADDR_MODE_ZERO_PAGE_X: return 2;
-        case ADDR_MODE_ZERO_PAGE_Y: return 2;
-        default: return 0;
+    return get_instruction_size(mode);
+}
+
+// Runs instructions until at least max_cycles CPU cycles have passed or, with
+// stop_on_frame, until the PPU starts a new frame. The PPU isn't ticked after
+// every instruction, it's caught up at sync points: PPU and mapper accesses
+// (cpu_sync_ppu()) and the earliest event in agnes->scheduler, which are the
+// PPU's next vblank and mapper IRQ, the end of a DMA stall and the end of the
+// run. Returns the cycles run or -1 on an illegal opcode.
+int instruction_run(cpu_t *cpu, int max_cycles, bool stop_on_frame) {
+    ppu_t *ppu = &cpu->agnes->ppu;
+    scheduler_t *sched = &cpu->agnes->scheduler;
+    uint8_t code_buf[3];
+    const uint8_t *code = code_buf;
+    int cycles = 0;
+    int cycles_run = 0;
+
+#define INS(OPC, NAME, CYCLES, PCC, IDLE, OP, MODE) \
+    HANDLER_BEGIN(OPC) { \
+        cycles += run_##OPC(cpu, decode_operand(MODE, cpu->pc, code)); \
+        HANDLER_END() \
+    }
+#define INE(OPC)
+
+#if AGNES_DISPATCH == AGNES_DISPATCH_THREADED
+#define DISPATCH_ENTRY(OPC, NAME, CYCLES, PCC, IDLE, OP, MODE) &&ins_##OPC,
+#define DISPATCH_ILLEGAL(OPC) &&illegal,
+    static void *dispatch_table[256] = {
+        AGNES_INSTRUCTIONS(DISPATCH_ENTRY, DISPATCH_ILLEGAL)
+    };
+#undef DISPATCH_ILLEGAL
+#undef DISPATCH_ENTRY
+
+// Every handler finishes the instruction and jumps straight to the next one,
+// so each has its own indirect branch to predict.
+#define HANDLER_BEGIN(OPC) ins_##OPC:
+#define HANDLER_END() \
+        cpu->cycles += cycles; \
+        cpu->sync.cycles += cycles; \
+        if (cpu->sync.cycles >= cpu->sync.limit || cpu->stall > 0 || cpu->cpu_interrupt != INTERRUPT_NONE \
+         || (AGNES_BLOCK_CACHE && cpu->pc >= 0x8000)) { \
+            continue; \
+        } \
+        cycles = 0; \
+        code = fetch_code(cpu, code_buf); \
+        goto *dispatch_table[code[0]];
+#else
+#define HANDLER_BEGIN(OPC) case OPC:
+#define HANDLER_END() break;
+#endif
+
+    cpu->sync.cycles = 0;
+    cpu->sync.ppu_cycles = 0;
+    cpu->sync.limit = 0;
+    scheduler_set(sched, EVENT_RUN_END, max_cycles);
+    scheduler_cancel(sched, EVENT_DMA_END); // cpu_tick() might have run part of it
+
+    while (true) {
+        if (cpu->sync.cycles >= cpu->sync.limit) {
+            bool new_frame = false;
+            ppu_run(ppu, cpu->sync.cycles - cpu->sync.ppu_cycles, &new_frame);
+            scheduler_advance(sched, cpu->sync.cycles);
+            cycles_run += cpu->sync.cycles;
+            cpu->sync.cycles = 0;
+            cpu->sync.ppu_cycles = 0;
+            if (new_frame) {
+                cpu->idle.frame_skipped_cycles = cpu->idle.skipped_cycles;
+                cpu->idle.skipped_cycles = 0;
+            }
+            if (cycles_run >= max_cycles || (stop_on_frame && new_frame)) {
+                cpu->sync.limit = 0; // cpu_tick() runs in lockstep
+                return cycles_run;
+            }
+            // Anything the CPU did since the last sync point may have moved
+            // the PPU's events, the others keep their due times
+            ppu_schedule_events(ppu, sched);
+            if (cpu->stall == 0) {
+                scheduler_cancel(sched, EVENT_DMA_END);
+            } else if (!scheduler_is_pending(sched, EVENT_DMA_END)) {
+                scheduler_set(sched, EVENT_DMA_END, cpu->stall);
+            }
+            cpu->sync.limit = scheduler_cycles_until_next(sched);
+        }
+
+        if (cpu->stall > 0) {
+            // Stall cycles don't count towards cpu->cycles and run up to
+            // EVENT_DMA_END, or an earlier event
+            uint32_t stall = cpu->sync.limit - cpu->sync.cycles;
+            if (stall > cpu->stall) {
+                stall = cpu->stall;
+            }
+            cpu->stall -= stall;
+            cpu->sync.cycles += stall;
+            continue;
+        }
+
+        cycles = 0;
+        if (cpu->cpu_interrupt != INTERRUPT_NONE) {
+            cycles += cpu_handle_interrupt(cpu);
+        }
+
+#if AGNES_BLOCK_CACHE
+        const block_t *block = block_cache_get(cpu->agnes->block_cache, cpu);
+        if (block) {
+            const block_instruction_t *ins = block->instructions;
+            const block_instruction_t *end = ins + block->count;
+            for (; ins < end; ins++) {
+                cycles += ins->handler(cpu, ins->operands);
+                cpu->cycles += cycles;
+                cpu->sync.cycles += cycles;
+                cycles = 0;
+                // Anything that needs the main loop ends the block early,
+                // including mapper writes that might switch its bank out
+                if (cpu->sync.cycles >= cpu->sync.limit || cpu->stall > 0 || cpu->cpu_interrupt != INTERRUPT_NONE) {
+                    break;
+                }
+            }
+            continue;
+        }
+#endif
+
+        code = fetch_code(cpu, code_buf);
+#if AGNES_DISPATCH == AGNES_DISPATCH_THREADED
+        goto *dispatch_table[code[0]];
+        AGNES_INSTRUCTIONS(INS, INE)
+#else
+        switch (code[0]) {
+            AGNES_INSTRUCTIONS(INS, INE)
+            default:
+                goto illegal;
+        }
+        cpu->cycles += cycles;
+        cpu->sync.cycles += cycles;
+#endif
     }
+
+illegal:
+    cpu_sync_ppu(cpu);
+    cpu->sync.cycles = 0;
+    cpu->sync.ppu_cycles = 0;
+    cpu->sync.limit = 0;
+    return -1;
+
+#undef HANDLER_END
+#undef HANDLER_BEGIN
+#undef INE
+#undef INS
 }
 
-static int op_adc(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_adc(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     uint8_t old_acc = cpu->acc;
-    uint8_t val = cpu_read8(cpu, addr);
+    uint8_t val = read_operand(cpu, addr, mode);
     int res = cpu->acc + val + (uint8_t)cpu->flag_carry;
     cpu->acc = (uint8_t)res;
     cpu->flag_carry = res > 0xff;
-    cpu->flag_overflow = !((old_acc ^ val) & 0x80) && ((old_acc ^ cpu->acc) & 0x80);
-    cpu_update_zn_flags(cpu, cpu->acc);
+    CPU_SET_V_FROM(cpu, ~(old_acc ^ val) & (old_acc ^ cpu->acc));
+    CPU_SET_ZN(cpu, cpu->acc);
     return 0;
 }
 
-static int op_and(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    uint8_t val = cpu_read8(cpu, addr);
+static AGNES_ALWAYS_INLINE int op_and(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    uint8_t val = read_operand(cpu, addr, mode);
     cpu->acc = cpu->acc & val;
-    cpu_update_zn_flags(cpu, cpu->acc);
+    CPU_SET_ZN(cpu, cpu->acc);
     return 0;
 }
 
-static int op_asl(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    if (mode == ADDR_MODE_ACCUMULATOR) {
-        cpu->flag_carry = AGNES_GET_BIT(cpu->acc, 7);
-        cpu->acc = cpu->acc << 1;
-        cpu_update_zn_flags(cpu, cpu->acc);
-    } else {
-        uint8_t val = cpu_read8(cpu, addr);
-        cpu->flag_carry = AGNES_GET_BIT(val, 7);
-        val = val << 1;
-        cpu_write8(cpu, addr, val);
-        cpu_update_zn_flags(cpu, val);
-    }
+static AGNES_ALWAYS_INLINE int op_asl(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    uint8_t val = read_operand(cpu, addr, mode);
+    cpu->flag_carry = AGNES_GET_BIT(val, 7);
+    val = val << 1;
+    write_operand(cpu, addr, mode, val);
+    CPU_SET_ZN(cpu, val);
     return 0;
 }
 
-static int op_bcc(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_bcc(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     return !cpu->flag_carry ? take_branch(cpu, addr) : 0;
 }
 
-static int op_bcs(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_bcs(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     return cpu->flag_carry ? take_branch(cpu, addr) : 0;
 }
 
-static int op_beq(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    return cpu->flag_zero ? take_branch(cpu, addr) : 0;
+static AGNES_ALWAYS_INLINE int op_beq(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    return CPU_FLAG_Z(cpu) ? take_branch(cpu, addr) : 0;
 }
 
-static int op_bit(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    uint8_t val = cpu_read8(cpu, addr);
+static AGNES_ALWAYS_INLINE int op_bit(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    uint8_t val = read_operand(cpu, addr, mode);
     uint8_t res = cpu->acc & val;
-    cpu->flag_zero = res == 0;
-    cpu->flag_overflow = AGNES_GET_BIT(val, 6);
-    cpu->flag_negative = AGNES_GET_BIT(val, 7);
+    CPU_SET_Z_FROM(cpu, res);
+    CPU_SET_V_FROM(cpu, val << 1);
+    CPU_SET_N_FROM(cpu, val);
     return 0;
 }
 
-static int op_bmi(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    return cpu->flag_negative ? take_branch(cpu, addr) : 0;
+static AGNES_ALWAYS_INLINE int op_bmi(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    return CPU_FLAG_N(cpu) ? take_branch(cpu, addr) : 0;
 }
 
-static int op_bne(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    return !cpu->flag_zero ? take_branch(cpu, addr) : 0;
+static AGNES_ALWAYS_INLINE int op_bne(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    return !CPU_FLAG_Z(cpu) ? take_branch(cpu, addr) : 0;
 }
 
-static int op_bpl(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    return !cpu->flag_negative ? take_branch(cpu, addr) : 0;
+static AGNES_ALWAYS_INLINE int op_bpl(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    return !CPU_FLAG_N(cpu) ? take_branch(cpu, addr) : 0;
 }
 
-static int op_brk(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_brk(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu_stack_push16(cpu, cpu->pc);
     uint8_t flags = cpu_get_flags(cpu);
     cpu_stack_push8(cpu, flags | 0x30);
@@ -429,303 +629,716 @@ static int op_brk(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     return 0;
 }
 
-static int op_bvc(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    return !cpu->flag_overflow ? take_branch(cpu, addr) : 0;
+static AGNES_ALWAYS_INLINE int op_bvc(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    return !CPU_FLAG_V(cpu) ? take_branch(cpu, addr) : 0;
 }
 
-static int op_bvs(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    return cpu->flag_overflow ? take_branch(cpu, addr) : 0;
+static AGNES_ALWAYS_INLINE int op_bvs(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    return CPU_FLAG_V(cpu) ? take_branch(cpu, addr) : 0;
 }
 
-static int op_clc(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_clc(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu->flag_carry = false;
     return 0;
 }
 
-static int op_cld(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_cld(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu->flag_decimal = false;
     return 0;
 }
 
-static int op_cli(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_cli(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu->flag_dis_interrupt = false;
     return 0;
 }
 
-static int op_clv(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    cpu->flag_overflow = false;
+static AGNES_ALWAYS_INLINE int op_clv(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    CPU_SET_V_FROM(cpu, 0);
     return 0;
 }
 
-static int op_cmp(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    uint8_t val = cpu_read8(cpu, addr);
-    cpu_update_zn_flags(cpu, cpu->acc - val);
+static AGNES_ALWAYS_INLINE int op_cmp(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    uint8_t val = read_operand(cpu, addr, mode);
+    CPU_SET_ZN(cpu, cpu->acc - val);
     cpu->flag_carry = cpu->acc >= val;
     return 0;
 }
 
-static int op_cpx(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    uint8_t val = cpu_read8(cpu, addr);
-    cpu_update_zn_flags(cpu, cpu->x - val);
+static AGNES_ALWAYS_INLINE int op_cpx(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    uint8_t val = read_operand(cpu, addr, mode);
+    CPU_SET_ZN(cpu, cpu->x - val);
     cpu->flag_carry = cpu->x >= val;
     return 0;
 }
 
-static int op_cpy(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    uint8_t val = cpu_read8(cpu, addr);
-    cpu_update_zn_flags(cpu, cpu->y - val);
+static AGNES_ALWAYS_INLINE int op_cpy(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    uint8_t val = read_operand(cpu, addr, mode);
+    CPU_SET_ZN(cpu, cpu->y - val);
     cpu->flag_carry = cpu->y >= val;
     return 0;
 }
 
-static int op_dec(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    uint8_t val = cpu_read8(cpu, addr);
-    cpu_write8(cpu, addr, val - 1);
-    cpu_update_zn_flags(cpu, val - 1);
+static AGNES_ALWAYS_INLINE int op_dec(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    uint8_t val = read_operand(cpu, addr, mode);
+    write_operand(cpu, addr, mode, val - 1);
+    CPU_SET_ZN(cpu, val - 1);
     return 0;
 }
 
-static int op_dex(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_dex(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu->x--;
-    cpu_update_zn_flags(cpu, cpu->x);
+    CPU_SET_ZN(cpu, cpu->x);
     return 0;
 }
 
-static int op_dey(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_dey(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu->y--;
-    cpu_update_zn_flags(cpu, cpu->y);
+    CPU_SET_ZN(cpu, cpu->y);
     return 0;
 }
 
-static int op_eor(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    uint8_t val = cpu_read8(cpu, addr);
+static AGNES_ALWAYS_INLINE int op_eor(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    uint8_t val = read_operand(cpu, addr, mode);
     cpu->acc = cpu->acc ^ val;
-    cpu_update_zn_flags(cpu, cpu->acc);
+    CPU_SET_ZN(cpu, cpu->acc);
     return 0;
 }
 
-static int op_inc(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    uint8_t val = cpu_read8(cpu, addr);
-    cpu_write8(cpu, addr, val + 1);
-    cpu_update_zn_flags(cpu, val + 1);
+static AGNES_ALWAYS_INLINE int op_inc(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    uint8_t val = read_operand(cpu, addr, mode);
+    write_operand(cpu, addr, mode, val + 1);
+    CPU_SET_ZN(cpu, val + 1);
     return 0;
 }
 
-static int op_inx(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_inx(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu->x++;
-    cpu_update_zn_flags(cpu, cpu->x);
+    CPU_SET_ZN(cpu, cpu->x);
     return 0;
 }
 
-static int op_iny(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_iny(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu->y++;
-    cpu_update_zn_flags(cpu, cpu->y);
+    CPU_SET_ZN(cpu, cpu->y);
     return 0;
 }
 
-static int op_jmp(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_jmp(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu->pc = addr;
     return 0;
 }
 
-static int op_jsr(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_jsr(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu_stack_push16(cpu, cpu->pc - 1);
     cpu->pc = addr;
     return 0;
 }
 
-static int op_lda(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    uint8_t val = cpu_read8(cpu, addr);
+static AGNES_ALWAYS_INLINE int op_lda(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    uint8_t val = read_operand(cpu, addr, mode);
     cpu->acc = val;
-    cpu_update_zn_flags(cpu, cpu->acc);
+    CPU_SET_ZN(cpu, cpu->acc);
     return 0;
 }
 
-static int op_ldx(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    uint8_t val = cpu_read8(cpu, addr);
+static AGNES_ALWAYS_INLINE int op_ldx(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    uint8_t val = read_operand(cpu, addr, mode);
     cpu->x = val;
-    cpu_update_zn_flags(cpu, cpu->x);
+    CPU_SET_ZN(cpu, cpu->x);
     return 0;
 }
 
-static int op_ldy(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    uint8_t val = cpu_read8(cpu, addr);
+static AGNES_ALWAYS_INLINE int op_ldy(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    uint8_t val = read_operand(cpu, addr, mode);
     cpu->y = val;
-    cpu_update_zn_flags(cpu, cpu->y);
+    CPU_SET_ZN(cpu, cpu->y);
     return 0;
 }
 
-static int op_lsr(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    if (mode == ADDR_MODE_ACCUMULATOR) {
-        cpu->flag_carry = AGNES_GET_BIT(cpu->acc, 0);
-        cpu->acc = cpu->acc >> 1;
-        cpu_update_zn_flags(cpu, cpu->acc);
-    } else {
-        uint8_t val = cpu_read8(cpu, addr);
-        cpu->flag_carry = AGNES_GET_BIT(val, 0);
-        val = val >> 1;
-        cpu_write8(cpu, addr, val);
-        cpu_update_zn_flags(cpu, val);
-    }
+static AGNES_ALWAYS_INLINE int op_lsr(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    uint8_t val = read_operand(cpu, addr, mode);
+    cpu->flag_carry = AGNES_GET_BIT(val, 0);
+    val = val >> 1;
+    write_operand(cpu, addr, mode, val);
+    CPU_SET_ZN(cpu, val);
     return 0;
 }
 
-static int op_nop(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_nop(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     return 0;
 }
 
-static int op_ora(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    uint8_t val = cpu_read8(cpu, addr);
+static AGNES_ALWAYS_INLINE int op_ora(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    uint8_t val = read_operand(cpu, addr, mode);
     cpu->acc = cpu->acc | val;
-    cpu_update_zn_flags(cpu, cpu->acc);
+    CPU_SET_ZN(cpu, cpu->acc);
     return 0;
 }
 
-static int op_pha(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_pha(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu_stack_push8(cpu, cpu->acc);
     return 0;
 }
 
-static int op_php(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_php(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     uint8_t flags = cpu_get_flags(cpu);
     cpu_stack_push8(cpu, flags | 0x30);
     return 0;
 }
 
-static int op_pla(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_pla(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu->acc = cpu_stack_pop8(cpu);
-    cpu_update_zn_flags(cpu, cpu->acc);
+    CPU_SET_ZN(cpu, cpu->acc);
     return 0;
 }
 
-static int op_plp(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_plp(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     uint8_t flags = cpu_stack_pop8(cpu);
     cpu_restore_flags(cpu, flags);
     return 0;
 }
 
-static int op_rol(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_rol(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     uint8_t old_carry = cpu->flag_carry;
-    if (mode == ADDR_MODE_ACCUMULATOR) {
-        cpu->flag_carry = AGNES_GET_BIT(cpu->acc, 7);
-        cpu->acc = (cpu->acc << 1) | old_carry;
-        cpu_update_zn_flags(cpu, cpu->acc);
-    } else {
-        uint8_t val = cpu_read8(cpu, addr);
-        cpu->flag_carry = AGNES_GET_BIT(val, 7);
-        val = (val << 1) | old_carry;
-        cpu_write8(cpu, addr, val);
-        cpu_update_zn_flags(cpu, val);
-    }
+    uint8_t val = read_operand(cpu, addr, mode);
+    cpu->flag_carry = AGNES_GET_BIT(val, 7);
+    val = (val << 1) | old_carry;
+    write_operand(cpu, addr, mode, val);
+    CPU_SET_ZN(cpu, val);
     return 0;
 }
 
-static int op_ror(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_ror(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     uint8_t old_carry = cpu->flag_carry;
-    if (mode == ADDR_MODE_ACCUMULATOR) {
-        cpu->flag_carry = AGNES_GET_BIT(cpu->acc, 0);
-        cpu->acc = (cpu->acc >> 1) | (old_carry << 7);
-        cpu_update_zn_flags(cpu, cpu->acc);
-    } else {
-        uint8_t val = cpu_read8(cpu, addr);
-        cpu->flag_carry = AGNES_GET_BIT(val, 0);
-        val = (val >> 1) | (old_carry << 7);
-        cpu_write8(cpu, addr, val);
-        cpu_update_zn_flags(cpu, val);
-    }
+    uint8_t val = read_operand(cpu, addr, mode);
+    cpu->flag_carry = AGNES_GET_BIT(val, 0);
+    val = (val >> 1) | (old_carry << 7);
+    write_operand(cpu, addr, mode, val);
+    CPU_SET_ZN(cpu, val);
     return 0;
 }
 
-static int op_rti(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_rti(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     uint8_t flags = cpu_stack_pop8(cpu);
     cpu_restore_flags(cpu, flags);
     cpu->pc = cpu_stack_pop16(cpu);
     return 0;
 }
 
-static int op_rts(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_rts(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu->pc = cpu_stack_pop16(cpu) + 1;
     return 0;
 }
 
-static int op_sbc(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    uint8_t val = cpu_read8(cpu, addr);
+static AGNES_ALWAYS_INLINE int op_sbc(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    uint8_t val = read_operand(cpu, addr, mode);
     uint8_t old_acc = cpu->acc;
     int res = cpu->acc - val - (cpu->flag_carry ? 0 : 1);
     cpu->acc = (uint8_t)res;
-    cpu_update_zn_flags(cpu, cpu->acc);
+    CPU_SET_ZN(cpu, cpu->acc);
     cpu->flag_carry = res >= 0;
-    cpu->flag_overflow = ((old_acc ^ val) & 0x80) && ((old_acc ^ cpu->acc) & 0x80);
+    CPU_SET_V_FROM(cpu, (old_acc ^ val) & (old_acc ^ cpu->acc));
     return 0;
 }
 
-static int op_sec(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_sec(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu->flag_carry = true;
     return 0;
 }
 
-static int op_sed(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_sed(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu->flag_decimal = true;
     return 0;
 }
 
-static int op_sei(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_sei(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu->flag_dis_interrupt = true;
     return 0;
 }
 
-static int op_sta(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    cpu_write8(cpu, addr, cpu->acc);
+static AGNES_ALWAYS_INLINE int op_sta(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    write_operand(cpu, addr, mode, cpu->acc);
     return 0;
 }
 
-static int op_stx(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    cpu_write8(cpu, addr, cpu->x);
+static AGNES_ALWAYS_INLINE int op_stx(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    write_operand(cpu, addr, mode, cpu->x);
     return 0;
 }
 
-static int op_sty(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
-    cpu_write8(cpu, addr, cpu->y);
+static AGNES_ALWAYS_INLINE int op_sty(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    write_operand(cpu, addr, mode, cpu->y);
     return 0;
 }
 
-static int op_tax(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_tax(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu->x = cpu->acc;
-    cpu_update_zn_flags(cpu, cpu->x);
+    CPU_SET_ZN(cpu, cpu->x);
     return 0;
 }
 
-static int op_tay(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_tay(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu->y = cpu->acc;
-    cpu_update_zn_flags(cpu, cpu->y);
+    CPU_SET_ZN(cpu, cpu->y);
     return 0;
 }
 
-static int op_tsx(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_tsx(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu->x = cpu->sp;
-    cpu_update_zn_flags(cpu, cpu->x);
+    CPU_SET_ZN(cpu, cpu->x);
     return 0;
 }
 
-static int op_txa(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_txa(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu->acc = cpu->x;
-    cpu_update_zn_flags(cpu, cpu->acc);
+    CPU_SET_ZN(cpu, cpu->acc);
     return 0;
 }
 
-static int op_txs(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_txs(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu->sp = cpu->x;
     return 0;
 }
 
-static int op_tya(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+static AGNES_ALWAYS_INLINE int op_tya(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
     cpu->acc = cpu->y;
-    cpu_update_zn_flags(cpu, cpu->acc);
+    CPU_SET_ZN(cpu, cpu->acc);
     return 0;
 }
 
 static int take_branch(cpu_t *cpu, uint16_t addr) {
     bool page_crossed = (cpu->pc & 0xff00) != (addr & 0xff00);
+    int extra_cycles = page_crossed ? 2 : 1;
+#if AGNES_SKIP_IDLE_LOOPS
+    uint16_t branch_pc = cpu->pc - 2;
+    cpu->pc = addr;
+    if (addr < branch_pc) {
+        skip_idle_loop(cpu, branch_pc, 2 + extra_cycles);
+    }
+#else
     cpu->pc = addr;
-    return page_crossed ? 2 : 1;
+#endif
+    return extra_cycles;
+}
+
+#if AGNES_SKIP_IDLE_LOOPS
+// A backward branch taken twice in a row with the same registers and flags
+// closes a loop spinning in place, as long as its body only reads memory that
+// nothing but the CPU changes, or PPUSTATUS. Every further iteration is then
+// the same until an interrupt or a change of PPUSTATUS, so the ones that end
+// before the next sync point are skipped by just counting their cycles.
+static void skip_idle_loop(cpu_t *cpu, uint16_t branch_pc, int branch_cycles) {
+    uint8_t flags = cpu_get_flags(cpu);
+    if (cpu->idle.pc != branch_pc || cpu->idle.acc != cpu->acc || cpu->idle.x != cpu->x
+     || cpu->idle.y != cpu->y || cpu->idle.flags != flags) {
+        cpu->idle.pc = branch_pc;
+        cpu->idle.acc = cpu->acc;
+        cpu->idle.x = cpu->x;
+        cpu->idle.y = cpu->y;
+        cpu->idle.flags = flags;
+        cpu->idle.checked = 0;
+        cpu->idle.cycles = cpu->cycles;
+        return;
+    }
+
+    int iteration_cycles = cpu->cycles - cpu->idle.cycles;
+    cpu->idle.cycles = cpu->cycles;
+    if (cpu->idle.checked == 0) {
+        cpu->idle.checked = check_idle_loop(cpu, cpu->pc, branch_pc) ? 1 : 2;
+    }
+    if (cpu->idle.checked != 1) {
+        return;
+    }
+
+    // Cycles from the end of this branch to the last one before the sync point
+    int budget = cpu->sync.limit - 1 - (cpu->sync.cycles + branch_cycles);
+    if (cpu->idle.reads_status) {
+        // Each iteration reads PPUSTATUS one iteration later than the last, so
+        // that's predictable as long as the PPU hasn't moved past the last read
+        uint32_t ppu_at_cycles = cpu->cycles - (cpu->sync.cycles - cpu->sync.ppu_cycles);
+        if (cpu->idle.ppu_read_cycles != ppu_at_cycles) {
+            return;
+        }
+        int status_cycles = ppu_cycles_until_status_change(&cpu->agnes->ppu);
+        if (status_cycles < budget) {
+            budget = status_cycles;
+        }
+    }
+    if (budget < iteration_cycles) {
+        return;
+    }
+
+    int skipped = budget - (budget % iteration_cycles);
+    cpu->cycles += skipped;
+    cpu->sync.cycles += skipped;
+    cpu->idle.cycles = cpu->cycles;
+    cpu->idle.skipped_cycles += skipped;
+}
+
+// Whether the loop from start to the branch at branch_pc only does what
+// skip_idle_loop() can skip
+static bool check_idle_loop(cpu_t *cpu, uint16_t start, uint16_t branch_pc) {
+    if (branch_pc - start > 32 || !cpu->read_pages[start >> 8] || !cpu->read_pages[(branch_pc + 1) >> 8]) {
+        return false;
+    }
+
+    cpu->idle.reads_status = false;
+    uint16_t pc = start;
+    while (pc < branch_pc) {
+        uint8_t bytes[3];
+        for (int i = 0; i < 3; i++) {
+            bytes[i] = cpu_read8(cpu, pc + i);
+        }
+        if (!instruction_idle_safe[bytes[0]]) {
+            return false;
+        }
+        const instruction_t *ins = &instructions[bytes[0]];
+
+        uint16_t operand = instruction_decode_operand(ins->mode, pc, bytes);
+        switch (ins->mode) {
+            case ADDR_MODE_IMPLIED:
+            case ADDR_MODE_IMMEDIATE:
+            case ADDR_MODE_ZERO_PAGE:
+            case ADDR_MODE_ZERO_PAGE_X:
+            case ADDR_MODE_ZERO_PAGE_Y:
+                break;
+            case ADDR_MODE_ABSOLUTE:
+                if (operand >= 0x2000 && operand < 0x4000 && (operand & 0x7) == 0x2) { // PPUSTATUS
+                    cpu->idle.reads_status = true;
+                } else if (!is_plain_memory(cpu, operand, operand)) {
+                    return false;
+                }
+                break;
+            case ADDR_MODE_ABSOLUTE_X:
+            case ADDR_MODE_ABSOLUTE_Y:
+                if (!is_plain_memory(cpu, operand, operand + 0xff)) {
+                    return false;
+                }
+                break;
+            case ADDR_MODE_INDIRECT_Y: {
+                uint16_t base = cpu_read16_zero_page(cpu, operand);
+                if (!is_plain_memory(cpu, base, base + 0xff)) {
+                    return false;
+                }
+                break;
+            }
+            default:
+                return false;
+        }
+        pc += get_instruction_size(ins->mode);
+    }
+    return pc == branch_pc;
+}
+
+// Whether first to last is RAM, PRG RAM or PRG ROM
+static bool is_plain_memory(cpu_t *cpu, uint16_t first, uint16_t last) {
+    if (last < first) {
+        return false;
+    }
+    for (unsigned page = first >> 8; page <= (unsigned)(last >> 8); page++) {
+        if (page >= 0x20 && (page < 0x60 || !cpu->read_pages[page])) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+#if AGNES_PROFILE
+#define PROFILE_INSTRUCTION(cpu, opcode, mode, extra_cycles) profile_instruction(cpu, opcode, mode, extra_cycles)
+
+// extra_cycles are the ones on top of the opcode's base cycles: page crossing
+// or, for branches, 1 when taken and 2 when taken to another page
+static void profile_instruction(cpu_t *cpu, uint8_t opcode, addr_mode_t mode, int extra_cycles) {
+    agnes_profile_t *profile = &cpu->agnes->profile;
+    int cycles = instruction_execs[opcode].cycles + extra_cycles;
+    profile->opcode_count[opcode]++;
+    profile->opcode_cycles[opcode] += cycles;
+    profile->mode_count[mode]++;
+    profile->mode_cycles[mode] += cycles;
+    if (mode == ADDR_MODE_RELATIVE) {
+        if (extra_cycles > 0) {
+            profile->branches_taken++;
+            profile->page_cross_cycles += extra_cycles - 1;
+        } else {
+            profile->branches_not_taken++;
+        }
+    } else {
+        profile->page_cross_cycles += extra_cycles;
+    }
+}
+#else
+#define PROFILE_INSTRUCTION(cpu, opcode, mode, extra_cycles) ((void)0)
+#endif
+
+// One handler per opcode: operand decode, the kind of memory access and the
+// operation are all resolved at compile time. run_XX() takes the operand as
+// fetched from memory, so decoded blocks can skip that step.
+#define INS(OPC, NAME, CYCLES, PCC, IDLE, OP, MODE) \
+    static AGNES_ALWAYS_INLINE int run_##OPC(cpu_t *cpu, uint16_t operand) { \
+        bool page_crossed = false; \
+        uint16_t addr = resolve_operand(cpu, MODE, operand, &page_crossed); \
+        cpu->pc += get_instruction_size(MODE); \
+        int cycles = CYCLES + OP(cpu, addr, MODE); \
+        if (PCC && page_crossed) { \
+            cycles += 1; \
+        } \
+        PROFILE_INSTRUCTION(cpu, OPC, MODE, cycles - CYCLES); \
+        return cycles; \
+    } \
+    static int ins_##OPC(cpu_t *cpu) { \
+        return run_##OPC(cpu, fetch_operand(cpu, MODE)); \
+    }
+#define INE(OPC)
+AGNES_INSTRUCTIONS(INS, INE)
+#undef INE
+#undef INS
+
+#if AGNES_BLOCK_CACHE
+#define INS(OPC, NAME, CYCLES, PCC, IDLE, OP, MODE) \
+    static int decoded_##OPC(cpu_t *cpu, uint32_t operands) { \
+        return run_##OPC(cpu, (uint16_t)operands); \
+    }
+#define INE(OPC)
+AGNES_INSTRUCTIONS(INS, INE)
+#undef INE
+#undef INS
+
+// Pairs that dominate typical game code, which decoded blocks run as a single
+// entry. The pair still accounts for its cycles in two steps, and stops after
+// the first instruction whenever the block would have, so timing is unchanged.
+#define AGNES_FUSED_PAIRS(PAIR) \
+    PAIR(0xca, 0xd0) /* DEX, BNE */ \
+    PAIR(0x88, 0xd0) /* DEY, BNE */ \
+    PAIR(0xc9, 0xd0) /* CMP #, BNE */ \
+    PAIR(0xc5, 0xd0) /* CMP zp, BNE */ \
+    PAIR(0xc8, 0xc0) /* INY, CPY # */ \
+    PAIR(0xe8, 0xe0) /* INX, CPX # */ \
+    PAIR(0xa5, 0xf0) /* LDA zp, BEQ */ \
+    PAIR(0xa5, 0xd0) /* LDA zp, BNE */ \
+    PAIR(0xa9, 0x85) /* LDA #, STA zp */ \
+    PAIR(0xa9, 0x8d) /* LDA #, STA abs */ \
+    PAIR(0xa5, 0x85) /* LDA zp, STA zp */ \
+    PAIR(0xa5, 0x8d) /* LDA zp, STA abs */ \
+    PAIR(0xad, 0x8d) /* LDA abs, STA abs */ \
+    PAIR(0xbd, 0x9d) /* LDA abs,X, STA abs,X */ \
+    PAIR(0xb9, 0x99) /* LDA abs,Y, STA abs,Y */ \
+    PAIR(0xb1, 0x91) /* LDA (zp),Y, STA (zp),Y */
+
+#define PAIR(FIRST, SECOND) \
+    static int fused_##FIRST##_##SECOND(cpu_t *cpu, uint32_t operands) { \
+        if (!finish_fused_first(cpu, run_##FIRST(cpu, (uint16_t)operands))) { \
+            return 0; \
+        } \
+        return run_##SECOND(cpu, (uint16_t)(operands >> 16)); \
+    }
+AGNES_FUSED_PAIRS(PAIR)
+#undef PAIR
+
+// Returns the handler running first_opcode and second_opcode as one or NULL
+instruction_decoded_fn instruction_get_fused(uint8_t first_opcode, uint8_t second_opcode) {
+#define PAIR(FIRST, SECOND) \
+    if (first_opcode == FIRST && second_opcode == SECOND) { \
+        return fused_##FIRST##_##SECOND; \
+    }
+    AGNES_FUSED_PAIRS(PAIR)
+#undef PAIR
+    return NULL;
+}
+
+// Accounts for the first instruction of a fused pair the way the block loop in
+// instruction_run() does, returns whether the second can follow right away
+static AGNES_ALWAYS_INLINE bool finish_fused_first(cpu_t *cpu, int cycles) {
+    cpu->cycles += cycles;
+    cpu->sync.cycles += cycles;
+    return cpu->sync.cycles < cpu->sync.limit && cpu->stall == 0 && cpu->cpu_interrupt == INTERRUPT_NONE;
+}
+#endif
+
+static uint16_t cpu_read16_indirect_bug(cpu_t *cpu, uint16_t addr) {
+    uint8_t lo = cpu_read8(cpu, addr);
+    uint8_t hi = cpu_read8(cpu, (addr & 0xff00) | ((addr + 1) & 0x00ff));
+    return (hi << 8) | lo;
+}
+
+// Operand bytes of the instruction at pc, or the target of a relative branch
+static AGNES_ALWAYS_INLINE uint16_t fetch_operand(cpu_t *cpu, addr_mode_t mode) {
+    switch (mode) {
+        case ADDR_MODE_ABSOLUTE:
+        case ADDR_MODE_ABSOLUTE_X:
+        case ADDR_MODE_ABSOLUTE_Y:
+        case ADDR_MODE_INDIRECT: {
+            return cpu_read16(cpu, cpu->pc + 1);
+        }
+        case ADDR_MODE_IMMEDIATE:
+        case ADDR_MODE_INDIRECT_X:
+        case ADDR_MODE_INDIRECT_Y:
+        case ADDR_MODE_ZERO_PAGE:
+        case ADDR_MODE_ZERO_PAGE_X:
+        case ADDR_MODE_ZERO_PAGE_Y: {
+            return cpu_read8(cpu, cpu->pc + 1);
+        }
+        case ADDR_MODE_RELATIVE: {
+            return get_branch_target(cpu->pc, cpu_read8(cpu, cpu->pc + 1));
+        }
+        default: {
+            return 0;
+        }
+    }
+}
+
+// Same as fetch_operand() for an instruction at pc stored at bytes
+uint16_t instruction_decode_operand(addr_mode_t mode, uint16_t pc, const uint8_t *bytes) {
+    return decode_operand(mode, pc, bytes);
+}
+
+static AGNES_ALWAYS_INLINE uint16_t decode_operand(addr_mode_t mode, uint16_t pc, const uint8_t *bytes) {
+    switch (mode) {
+        case ADDR_MODE_ABSOLUTE:
+        case ADDR_MODE_ABSOLUTE_X:
+        case ADDR_MODE_ABSOLUTE_Y:
+        case ADDR_MODE_INDIRECT: {
+            return (bytes[2] << 8) | bytes[1];
+        }
+        case ADDR_MODE_IMMEDIATE:
+        case ADDR_MODE_INDIRECT_X:
+        case ADDR_MODE_INDIRECT_Y:
+        case ADDR_MODE_ZERO_PAGE:
+        case ADDR_MODE_ZERO_PAGE_X:
+        case ADDR_MODE_ZERO_PAGE_Y: {
+            return bytes[1];
+        }
+        case ADDR_MODE_RELATIVE: {
+            return get_branch_target(pc, bytes[1]);
+        }
+        default: {
+            return 0;
+        }
+    }
+}
+
+// Returns the bytes of the instruction at cpu->pc. Code in a mapped page is
+// read in place, with one page lookup for the whole instruction. Anything
+// else goes through cpu_read8() byte by byte into buf, in the same order as
+// before and without reading past the instruction.
+static AGNES_ALWAYS_INLINE const uint8_t* fetch_code(cpu_t *cpu, uint8_t *buf) {
+    const uint8_t *page = cpu->read_pages[cpu->pc >> 8];
+    if (page && (cpu->pc & 0xff) <= 0xfd) {
+        return page + (cpu->pc & 0xff);
+    }
+    return fetch_code_slow(cpu, buf);
+}
+
+static const uint8_t* fetch_code_slow(cpu_t *cpu, uint8_t *buf) {
+    buf[0] = cpu_read8(cpu, cpu->pc);
+    unsigned size = get_instruction_size(instructions[buf[0]].mode);
+    for (unsigned i = 1; i < size; i++) {
+        buf[i] = cpu_read8(cpu, cpu->pc + i);
+    }
+    return buf;
+}
+
+static AGNES_ALWAYS_INLINE uint16_t get_branch_target(uint16_t pc, uint8_t offset) {
+    uint16_t ret_val = pc + offset + 2;
+    if (offset < 0x80) {
+        return ret_val;
+    } else {
+        return ret_val - 0x100;
+    }
+}
+
+// Effective address of an instruction with its operand already fetched
+static AGNES_ALWAYS_INLINE uint16_t resolve_operand(cpu_t *cpu, addr_mode_t mode, uint16_t operand, bool *out_pages_differ) {
+    *out_pages_differ = false;
+    switch (mode) {
+        case ADDR_MODE_ABSOLUTE: {
+            return operand;
+        }
+        case ADDR_MODE_ABSOLUTE_X: {
+            uint16_t res = operand + cpu->x;
+            *out_pages_differ = check_pages_differ(operand, res);
+            return res;
+        }
+        case ADDR_MODE_ABSOLUTE_Y: {
+            uint16_t res = operand + cpu->y;
+            *out_pages_differ = check_pages_differ(operand, res);
+            return res;
+        }
+        case ADDR_MODE_IMMEDIATE: {
+            return operand; // the value itself, read_operand() hands it over
+        }
+        case ADDR_MODE_INDIRECT: {
+            return cpu_read16_indirect_bug(cpu, operand);
+        }
+        case ADDR_MODE_INDIRECT_X: {
+            return cpu_read16_zero_page(cpu, operand + cpu->x);
+        }
+        case ADDR_MODE_INDIRECT_Y: {
+            uint16_t addr2 = cpu_read16_zero_page(cpu, operand);
+            uint16_t res = addr2 + cpu->y;
+            *out_pages_differ = check_pages_differ(addr2, res);
+            return res;
+        }
+        case ADDR_MODE_ZERO_PAGE: {
+            return operand;
+        }
+        case ADDR_MODE_ZERO_PAGE_X: {
+            return (operand + cpu->x) & 0xff;
+        }
+        case ADDR_MODE_ZERO_PAGE_Y: {
+            return (operand + cpu->y) & 0xff;
+        }
+        case ADDR_MODE_RELATIVE: {
+            return operand;
+        }
+        default: {
+            return 0;
+        }
+    }
+}
+
+static bool check_pages_differ(uint16_t a, uint16_t b) {
+    return (0xff00 & a) != (0xff00 & b);
+}
+
+static AGNES_ALWAYS_INLINE uint8_t get_instruction_size(addr_mode_t mode) {
+    switch (mode) {
+        case ADDR_MODE_NONE:        return 0;
+        case ADDR_MODE_ABSOLUTE:    return 3;
+        case ADDR_MODE_ABSOLUTE_X:  return 3;
+        case ADDR_MODE_ABSOLUTE_Y:  return 3;
+        case ADDR_MODE_ACCUMULATOR: return 1;
+        case ADDR_MODE_IMMEDIATE:   return 2;
+        case ADDR_MODE_IMPLIED:     return 1;
+        case ADDR_MODE_IMPLIED_BRK: return 2;
+        case ADDR_MODE_INDIRECT:    return 3;
+        case ADDR_MODE_INDIRECT_X:  return 2;
+        case ADDR_MODE_INDIRECT_Y:  return 2;
+        case ADDR_MODE_RELATIVE:    return 2;
+        case ADDR_MODE_ZERO_PAGE:   return 2;
+        case ADDR_MODE_ZERO_PAGE_X: return 2;
+        case ADDR_MODE_ZERO_PAGE_Y: return 2;
+        default: return 0;
+    }
+}
+
+static AGNES_ALWAYS_INLINE uint8_t read_operand(cpu_t *cpu, uint16_t addr, addr_mode_t mode) {
+    switch (mode) {
+        case ADDR_MODE_ACCUMULATOR: return cpu->acc;
+        case ADDR_MODE_IMMEDIATE: return (uint8_t)addr;
+        case ADDR_MODE_ZERO_PAGE:
+        case ADDR_MODE_ZERO_PAGE_X:
+        case ADDR_MODE_ZERO_PAGE_Y: return cpu->agnes->ram[addr];
+        default: return cpu_read8(cpu, addr);
+    }
+}
+
+static AGNES_ALWAYS_INLINE void write_operand(cpu_t *cpu, uint16_t addr, addr_mode_t mode, uint8_t val) {
+    switch (mode) {
+        case ADDR_MODE_ACCUMULATOR: cpu->acc = val; break;
+        case ADDR_MODE_ZERO_PAGE:
+        case ADDR_MODE_ZERO_PAGE_X:
+        case ADDR_MODE_ZERO_PAGE_Y: cpu->agnes->ram[addr] = val; break;
+        default: cpu_write8(cpu, addr, val); break;
+    }
 }
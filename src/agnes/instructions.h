@@ -25,18 +25,35 @@ typedef enum {
 
 typedef struct cpu cpu_t;
 
-typedef int (*instruction_op_fn)(cpu_t *cpu, uint16_t addr, addr_mode_t mode);
+// Executes a whole instruction, including advancing pc, and returns its cycles
+typedef int (*instruction_handler_fn)(cpu_t *cpu);
+
+// Same with the operand already fetched, see instruction_decode_operand().
+// Fused pairs get the second instruction's operand in the upper 16 bits.
+typedef int (*instruction_decoded_fn)(cpu_t *cpu, uint32_t operands);
 
 typedef struct {
-    const char *name;
-    uint8_t opcode;
     uint8_t cycles;
     bool page_cross_cycle;
+    instruction_handler_fn handler;
+} instruction_exec_t;
+
+typedef struct {
+    const char *name;
+    uint8_t opcode;
     addr_mode_t mode;
-    instruction_op_fn operation;
+#if AGNES_BLOCK_CACHE
+    instruction_decoded_fn decoded_handler;
+#endif
 } instruction_t;
 
 AGNES_INTERNAL instruction_t* instruction_get(uint8_t opcode);
+AGNES_INTERNAL instruction_exec_t* instruction_get_exec(uint8_t opcode);
 AGNES_INTERNAL uint8_t instruction_get_size(addr_mode_t mode);
+AGNES_INTERNAL uint16_t instruction_decode_operand(addr_mode_t mode, uint16_t pc, const uint8_t *bytes);
+#if AGNES_BLOCK_CACHE
+AGNES_INTERNAL instruction_decoded_fn instruction_get_fused(uint8_t first_opcode, uint8_t second_opcode);
+#endif
+AGNES_INTERNAL int instruction_run(cpu_t *cpu, int max_cycles, bool stop_on_frame);
 
 #endif /* opcodes_h */
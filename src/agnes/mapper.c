@@ -38,8 +38,44 @@ void mapper_write(agnes_t *agnes, uint16_t addr, uint8_t val) {
     }
 }
 
+// Whether a CPU write can change CHR banks, mirroring or the IRQ counter, which
+// the PPU has to see at the right dot. PRG banking and RAM don't matter to it.
+bool mapper_write_affects_ppu(agnes_t *agnes, uint16_t addr, uint8_t val) {
+    switch (agnes->gamepack.mapper) {
+        case 1: return mapper1_write_affects_ppu(&agnes->mapper.m1, addr, val);
+        case 4: return mapper4_write_affects_ppu(&agnes->mapper.m4, addr);
+        default: return false;
+    }
+}
+
 void mapper_pa12_rising_edge(agnes_t *agnes) {
     switch (agnes->gamepack.mapper) {
         case 4: mapper4_pa12_rising_edge(&agnes->mapper.m4); break;
     }
 }
+
+// Number of PA12 rising edges until the mapper triggers an IRQ, 0 for never
+unsigned mapper_edges_until_irq(agnes_t *agnes) {
+    switch (agnes->gamepack.mapper) {
+        case 4: return mapper4_edges_until_irq(&agnes->mapper.m4);
+        default: return 0;
+    }
+}
+
+void mapper_update_pages(agnes_t *agnes) {
+    switch (agnes->gamepack.mapper) {
+        case 0: mapper0_update_pages(&agnes->mapper.m0); break;
+        case 1: mapper1_update_pages(&agnes->mapper.m1); break;
+        case 2: mapper2_update_pages(&agnes->mapper.m2); break;
+        case 4: mapper4_update_pages(&agnes->mapper.m4); break;
+    }
+}
+
+void mapper_update_chr_pages(agnes_t *agnes) {
+    switch (agnes->gamepack.mapper) {
+        case 0: mapper0_update_chr_pages(&agnes->mapper.m0); break;
+        case 1: mapper1_update_chr_pages(&agnes->mapper.m1); break;
+        case 2: mapper2_update_chr_pages(&agnes->mapper.m2); break;
+        case 4: mapper4_update_chr_pages(&agnes->mapper.m4); break;
+    }
+}
@@ -10,6 +10,10 @@ typedef struct agnes agnes_t;
 AGNES_INTERNAL bool mapper_init(agnes_t *agnes);
 AGNES_INTERNAL uint8_t mapper_read(agnes_t *agnes, uint16_t addr);
 AGNES_INTERNAL void mapper_write(agnes_t *agnes, uint16_t addr, uint8_t val);
+AGNES_INTERNAL bool mapper_write_affects_ppu(agnes_t *agnes, uint16_t addr, uint8_t val);
 AGNES_INTERNAL void mapper_pa12_rising_edge(agnes_t *agnes);
+AGNES_INTERNAL unsigned mapper_edges_until_irq(agnes_t *agnes);
+AGNES_INTERNAL void mapper_update_pages(agnes_t *agnes);
+AGNES_INTERNAL void mapper_update_chr_pages(agnes_t *agnes);
 
 #endif /* mapper_h */
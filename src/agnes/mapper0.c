@@ -2,6 +2,9 @@
 #include "mapper0.h"
 
 #include "agnes_types.h"
+#include "chr_cache.h"
+#include "cpu.h"
+#include "ppu.h"
 #endif
 
 void mapper0_init(mapper0_t *mapper, agnes_t *agnes) {
@@ -33,5 +36,20 @@ uint8_t mapper0_read(mapper0_t *mapper, uint16_t addr) {
 void mapper0_write(mapper0_t *mapper, uint16_t addr, uint8_t val) {
     if (mapper->use_chr_ram && addr < 0x2000) {
         mapper->chr_ram[addr] = val;
+#if AGNES_CHR_CACHE
+        chr_cache_invalidate(mapper->agnes->chr_cache, addr, 1);
+#endif
     }
 }
+
+void mapper0_update_pages(mapper0_t *mapper) {
+    const uint8_t *prg_rom = mapper->agnes->gamepack.data + mapper->agnes->gamepack.prg_rom_offset;
+    cpu_map_memory(&mapper->agnes->cpu, 0x8000, 16 * 1024, prg_rom + mapper->prg_bank_offsets[0], NULL);
+    cpu_map_memory(&mapper->agnes->cpu, 0xc000, 16 * 1024, prg_rom + mapper->prg_bank_offsets[1], NULL);
+}
+
+void mapper0_update_chr_pages(mapper0_t *mapper) {
+    agnes_t *agnes = mapper->agnes;
+    const uint8_t *chr = mapper->use_chr_ram ? mapper->chr_ram : agnes->gamepack.data + agnes->gamepack.chr_rom_offset;
+    ppu_map_memory(&agnes->ppu, 0x0000, 8 * 1024, chr);
+}
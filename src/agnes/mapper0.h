@@ -11,5 +11,7 @@ typedef struct agnes agnes_t;
 AGNES_INTERNAL void mapper0_init(mapper0_t *mapper, agnes_t *agnes);
 AGNES_INTERNAL uint8_t mapper0_read(mapper0_t *mapper, uint16_t addr);
 AGNES_INTERNAL void mapper0_write(mapper0_t *mapper, uint16_t addr, uint8_t val);
+AGNES_INTERNAL void mapper0_update_pages(mapper0_t *mapper);
+AGNES_INTERNAL void mapper0_update_chr_pages(mapper0_t *mapper);
 
 #endif /* mapper0_h */
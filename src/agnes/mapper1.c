@@ -2,6 +2,9 @@
 #include "mapper1.h"
 
 #include "agnes_types.h"
+#include "chr_cache.h"
+#include "cpu.h"
+#include "ppu.h"
 #endif
 
 static void mapper1_write_control(mapper1_t *mapper, uint8_t val);
@@ -53,6 +56,9 @@ void mapper1_write(mapper1_t *mapper, uint16_t addr, uint8_t val) {
     if (addr < 0x2000) {
         if (mapper->use_chr_ram) {
             mapper->chr_ram[addr] = val;
+#if AGNES_CHR_CACHE
+            chr_cache_invalidate(mapper->agnes->chr_cache, addr, 1);
+#endif
         }
     } else if (addr >= 0x6000 && addr < 0x8000) {
         mapper->prg_ram[addr - 0x6000] = val;
@@ -83,6 +89,14 @@ void mapper1_write(mapper1_t *mapper, uint16_t addr, uint8_t val) {
     }
 }
 
+bool mapper1_write_affects_ppu(const mapper1_t *mapper, uint16_t addr, uint8_t val) {
+    if (addr < 0x8000 || AGNES_GET_BIT(val, 7)) { // a reset only changes the PRG mode
+        return false;
+    }
+    // Only the fifth write lands in a register, the last one is the PRG bank
+    return mapper->shift_count == 4 && ((addr >> 13) & 0x3) != 3;
+}
+
 static void mapper1_write_control(mapper1_t *mapper, uint8_t val) {
     mapper->control = val;
     switch (val & 0x3) {
@@ -91,11 +105,15 @@ static void mapper1_write_control(mapper1_t *mapper, uint8_t val) {
         case 2: mapper->agnes->mirroring_mode = MIRRORING_MODE_VERTICAL; break;
         case 3: mapper->agnes->mirroring_mode = MIRRORING_MODE_HORIZONTAL; break;
     }
+    ppu_update_pages(&mapper->agnes->ppu);
     mapper->prg_mode = (val >> 2) & 0x3;
     mapper->chr_mode = (val >> 4) & 0x1;
 }
 
 static void mapper1_set_offsets(mapper1_t *mapper) {
+#if AGNES_CHR_CACHE
+    unsigned old_chr_offsets[2] = { mapper->chr_bank_offsets[0], mapper->chr_bank_offsets[1] };
+#endif
     switch (mapper->chr_mode) {
         case 0: {
             mapper->chr_bank_offsets[0] = (mapper->chr_banks[0] & 0xfe) * (8 * 1024);
@@ -109,6 +127,15 @@ static void mapper1_set_offsets(mapper1_t *mapper) {
         }
     }
 
+#if AGNES_CHR_CACHE
+    // CHR RAM isn't banked
+    for (int i = 0; i < 2 && !mapper->use_chr_ram; i++) {
+        if (mapper->chr_bank_offsets[i] != old_chr_offsets[i]) {
+            chr_cache_invalidate(mapper->agnes->chr_cache, i * (4 * 1024), 4 * 1024);
+        }
+    }
+#endif
+
     switch (mapper->prg_mode) {
         case 0: case 1: {
             mapper->prg_bank_offsets[0] = (mapper->prg_bank & 0xe) * (32 * 1024);
@@ -126,4 +153,25 @@ static void mapper1_set_offsets(mapper1_t *mapper) {
             break;
         }
     }
+
+    mapper1_update_pages(mapper);
+    mapper1_update_chr_pages(mapper);
+}
+
+void mapper1_update_pages(mapper1_t *mapper) {
+    const uint8_t *prg_rom = mapper->agnes->gamepack.data + mapper->agnes->gamepack.prg_rom_offset;
+    cpu_map_memory(&mapper->agnes->cpu, 0x6000, sizeof(mapper->prg_ram), mapper->prg_ram, mapper->prg_ram);
+    cpu_map_memory(&mapper->agnes->cpu, 0x8000, 16 * 1024, prg_rom + mapper->prg_bank_offsets[0], NULL);
+    cpu_map_memory(&mapper->agnes->cpu, 0xc000, 16 * 1024, prg_rom + mapper->prg_bank_offsets[1], NULL);
+}
+
+void mapper1_update_chr_pages(mapper1_t *mapper) {
+    agnes_t *agnes = mapper->agnes;
+    if (mapper->use_chr_ram) {
+        ppu_map_memory(&agnes->ppu, 0x0000, 8 * 1024, mapper->chr_ram);
+        return;
+    }
+    const uint8_t *chr_rom = agnes->gamepack.data + agnes->gamepack.chr_rom_offset;
+    ppu_map_memory(&agnes->ppu, 0x0000, 4 * 1024, chr_rom + mapper->chr_bank_offsets[0]);
+    ppu_map_memory(&agnes->ppu, 0x1000, 4 * 1024, chr_rom + mapper->chr_bank_offsets[1]);
 }
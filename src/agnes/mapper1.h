@@ -11,5 +11,8 @@ typedef struct agnes agnes_t;
 AGNES_INTERNAL void mapper1_init(mapper1_t *mapper, agnes_t *agnes);
 AGNES_INTERNAL uint8_t mapper1_read(mapper1_t *mapper, uint16_t addr);
 AGNES_INTERNAL void mapper1_write(mapper1_t *mapper, uint16_t addr, uint8_t val);
+AGNES_INTERNAL bool mapper1_write_affects_ppu(const mapper1_t *mapper, uint16_t addr, uint8_t val);
+AGNES_INTERNAL void mapper1_update_pages(mapper1_t *mapper);
+AGNES_INTERNAL void mapper1_update_chr_pages(mapper1_t *mapper);
 
 #endif /* mapper1_h */
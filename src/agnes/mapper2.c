@@ -1,6 +1,9 @@
 #ifndef AGNES_SINGLE_HEADER
 #include "mapper2.h"
 #include "agnes_types.h"
+#include "chr_cache.h"
+#include "cpu.h"
+#include "ppu.h"
 #endif
 
 void mapper2_init(mapper2_t *mapper, agnes_t *agnes) {
@@ -26,8 +29,22 @@ uint8_t mapper2_read(mapper2_t *mapper, uint16_t addr) {
 void mapper2_write(mapper2_t *mapper, uint16_t addr, uint8_t val) {
     if (addr < 0x2000) {
         mapper->chr_ram[addr] = val;
+#if AGNES_CHR_CACHE
+        chr_cache_invalidate(mapper->agnes->chr_cache, addr, 1);
+#endif
     } else if (addr >= 0x8000) {
         int bank = val % (mapper->agnes->gamepack.prg_rom_banks_count);
         mapper->prg_bank_offsets[0] = bank * (16 * 1024);
+        mapper2_update_pages(mapper);
     }
 }
+
+void mapper2_update_pages(mapper2_t *mapper) {
+    const uint8_t *prg_rom = mapper->agnes->gamepack.data + mapper->agnes->gamepack.prg_rom_offset;
+    cpu_map_memory(&mapper->agnes->cpu, 0x8000, 16 * 1024, prg_rom + mapper->prg_bank_offsets[0], NULL);
+    cpu_map_memory(&mapper->agnes->cpu, 0xc000, 16 * 1024, prg_rom + mapper->prg_bank_offsets[1], NULL);
+}
+
+void mapper2_update_chr_pages(mapper2_t *mapper) {
+    ppu_map_memory(&mapper->agnes->ppu, 0x0000, 8 * 1024, mapper->chr_ram);
+}
@@ -11,5 +11,7 @@ typedef struct agnes agnes_t;
 AGNES_INTERNAL void mapper2_init(mapper2_t *mapper, agnes_t *agnes);
 AGNES_INTERNAL uint8_t mapper2_read(mapper2_t *mapper, uint16_t addr);
 AGNES_INTERNAL void mapper2_write(mapper2_t *mapper, uint16_t addr, uint8_t val);
+AGNES_INTERNAL void mapper2_update_pages(mapper2_t *mapper);
+AGNES_INTERNAL void mapper2_update_chr_pages(mapper2_t *mapper);
 
 #endif /* mapper2_h */
@@ -1,8 +1,12 @@
+#include <string.h>
+
 #ifndef AGNES_SINGLE_HEADER
 #include "mapper4.h"
 
 #include "agnes_types.h"
+#include "chr_cache.h"
 #include "cpu.h"
+#include "ppu.h"
 #endif
 
 static void mapper4_write_register(mapper4_t *mapper, uint16_t addr, uint8_t val);
@@ -43,6 +47,16 @@ void mapper4_pa12_rising_edge(mapper4_t *mapper) {
     }
 }
 
+unsigned mapper4_edges_until_irq(const mapper4_t *mapper) {
+    if (!mapper->irq_enabled) {
+        return 0;
+    }
+    if (mapper->counter == 0) { // next edge only reloads the counter
+        return mapper->counter_reload ? mapper->counter_reload + 1 : 0;
+    }
+    return mapper->counter;
+}
+
 uint8_t mapper4_read(mapper4_t *mapper, uint16_t addr) {
     uint8_t res = 0;
     if (addr < 0x2000) {
@@ -77,6 +91,14 @@ void mapper4_write(mapper4_t *mapper, uint16_t addr, uint8_t val) {
         unsigned addr_offset = addr & 0x3ff;
         unsigned full_offset = (bank_offset + addr_offset) & ((8 * 1024) - 1);
         mapper->chr_ram[full_offset] = val;
+#if AGNES_CHR_CACHE
+        // The same 1KB of CHR RAM can be mapped more than once
+        for (int i = 0; i < 8; i++) {
+            if (((mapper->chr_bank_offsets[i] >> 10) & 0x7) == (full_offset >> 10)) {
+                chr_cache_invalidate(mapper->agnes->chr_cache, (i << 10) | (full_offset & 0x3ff), 1);
+            }
+        }
+#endif
     } else if (addr >= 0x6000 && addr < 0x8000) {
          mapper->prg_ram[addr - 0x6000] = val;
     } else if (addr >= 0x8000) {
@@ -84,6 +106,18 @@ void mapper4_write(mapper4_t *mapper, uint16_t addr, uint8_t val) {
     }
 }
 
+bool mapper4_write_affects_ppu(const mapper4_t *mapper, uint16_t addr) {
+    bool addr_odd = addr & 0x1;
+    if (addr < 0x8000) { // PRG RAM
+        return false;
+    } else if (addr <= 0x9fff) { // Bank select can change the CHR mode, bank data R0-R5 are CHR banks
+        return !addr_odd || mapper->reg_ix < 6;
+    } else if (addr <= 0xbfff) { // Mirroring, PRG RAM protect
+        return !addr_odd;
+    }
+    return true; // IRQ
+}
+
 static void mapper4_write_register(mapper4_t *mapper, uint16_t addr, uint8_t val) {
     bool addr_odd = addr & 0x1;
     bool addr_even = !addr_odd;
@@ -98,6 +132,7 @@ static void mapper4_write_register(mapper4_t *mapper, uint16_t addr, uint8_t val
     } else if (addr <= 0xbffe && addr_even) { // Mirroring ($A000-$BFFE, even)
         if (mapper->agnes->mirroring_mode != MIRRORING_MODE_FOUR_SCREEN) {
             mapper->agnes->mirroring_mode = (val & 0x1) ? MIRRORING_MODE_HORIZONTAL : MIRRORING_MODE_VERTICAL;
+            ppu_update_pages(&mapper->agnes->ppu);
         }
     } else if (addr <= 0xbfff && addr_odd) { // PRG RAM protect ($A001-$BFFF, odd)
         // probably not required (according to https://wiki.nesdev.com/w/index.php/MMC3)
@@ -113,6 +148,10 @@ static void mapper4_write_register(mapper4_t *mapper, uint16_t addr, uint8_t val
 }
 
 static void mapper4_set_offsets(mapper4_t *mapper) {
+#if AGNES_CHR_CACHE
+    unsigned old_chr_offsets[8];
+    memcpy(old_chr_offsets, mapper->chr_bank_offsets, sizeof(old_chr_offsets));
+#endif
     switch (mapper->chr_mode) {
         case 0: { // R0_1, R0_2, R1_1, R1_2, R2, R3, R4, R5
             mapper->chr_bank_offsets[0] = (mapper->regs[0] & 0xfe) * 1024;
@@ -138,6 +177,14 @@ static void mapper4_set_offsets(mapper4_t *mapper) {
         }
     }
 
+#if AGNES_CHR_CACHE
+    for (int i = 0; i < 8; i++) {
+        if (mapper->chr_bank_offsets[i] != old_chr_offsets[i]) {
+            chr_cache_invalidate(mapper->agnes->chr_cache, i * 1024, 1024);
+        }
+    }
+#endif
+
     switch (mapper->prg_mode) {
         case 0: { // R6, R7, -2, -1
             mapper->prg_bank_offsets[0] = mapper->regs[6] * (8 * 1024);
@@ -154,4 +201,26 @@ static void mapper4_set_offsets(mapper4_t *mapper) {
             break;
         }
     }
+
+    mapper4_update_pages(mapper);
+    mapper4_update_chr_pages(mapper);
+}
+
+void mapper4_update_pages(mapper4_t *mapper) {
+    const uint8_t *prg_rom = mapper->agnes->gamepack.data + mapper->agnes->gamepack.prg_rom_offset;
+    cpu_map_memory(&mapper->agnes->cpu, 0x6000, sizeof(mapper->prg_ram), mapper->prg_ram, mapper->prg_ram);
+    for (int i = 0; i < 4; i++) {
+        cpu_map_memory(&mapper->agnes->cpu, 0x8000 + (i * 8 * 1024), 8 * 1024, prg_rom + mapper->prg_bank_offsets[i], NULL);
+    }
+}
+
+void mapper4_update_chr_pages(mapper4_t *mapper) {
+    agnes_t *agnes = mapper->agnes;
+    const uint8_t *chr_rom = agnes->gamepack.data + agnes->gamepack.chr_rom_offset;
+    unsigned chr_rom_size = agnes->gamepack.chr_rom_banks_count * (8 * 1024);
+    for (int i = 0; i < 8; i++) {
+        unsigned offset = mapper->chr_bank_offsets[i];
+        const uint8_t *page = mapper->use_chr_ram ? mapper->chr_ram + (offset & ((8 * 1024) - 1)) : chr_rom + (offset % chr_rom_size);
+        ppu_map_memory(&agnes->ppu, i * 1024, 1024, page);
+    }
 }
@@ -11,6 +11,10 @@ typedef struct agnes agnes_t;
 AGNES_INTERNAL void mapper4_init(mapper4_t *mapper, agnes_t *agnes);
 AGNES_INTERNAL uint8_t mapper4_read(mapper4_t *mapper, uint16_t addr);
 AGNES_INTERNAL void mapper4_write(mapper4_t *mapper, uint16_t addr, uint8_t val);
+AGNES_INTERNAL bool mapper4_write_affects_ppu(const mapper4_t *mapper, uint16_t addr);
+AGNES_INTERNAL void mapper4_update_pages(mapper4_t *mapper);
+AGNES_INTERNAL void mapper4_update_chr_pages(mapper4_t *mapper);
 AGNES_INTERNAL void mapper4_pa12_rising_edge(mapper4_t *mapper);
+AGNES_INTERNAL unsigned mapper4_edges_until_irq(const mapper4_t *mapper);
 
 #endif /* mapper4_h */
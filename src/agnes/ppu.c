@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
 
 #ifndef AGNES_SINGLE_HEADER
 #include "ppu.h"
@@ -8,29 +9,101 @@
 #include "agnes_types.h"
 #include "cpu.h"
 #include "mapper.h"
+#include "chr_cache.h"
+#include "framebuffer.h"
+#include "scheduler.h"
 #endif
 
 static void scanline_visible_pre(ppu_t *ppu, bool *out_new_frame);
+static void render_scanline(ppu_t *ppu);
+static void shift_bg(ppu_t *ppu);
+static void fetch_bg_tile(ppu_t *ppu);
+static void load_bg_tile(ppu_t *ppu);
+static uint16_t fetch_bg_nt_at(ppu_t *ppu);
+static void decode_bg_tile(uint8_t *out, uint8_t lo, uint8_t hi, uint8_t palette);
+#if AGNES_CHR_CACHE
+static void decode_bg_row(uint8_t *out, uint16_t pixels, uint8_t palette);
+#endif
+static void store_bg_pixels(uint8_t *out, uint32_t left, uint32_t right, uint8_t palette);
+static uint16_t read_pattern_row(ppu_t *ppu, uint16_t addr);
+static void clock_pa12(ppu_t *ppu);
 static void inc_hori_v(ppu_t *ppu);
 static void inc_vert_v(ppu_t *ppu);
-static void emit_pixel(ppu_t *ppu);
-static uint16_t get_bg_color_addr(ppu_t *ppu);
-static uint16_t get_sprite_color_addr(ppu_t *ppu, int *out_sprite_ix, bool *out_behind_bg);
+static void emit_pixel(ppu_t *ppu, int x, uint16_t bg_color_addr);
+static void fetch_bg_row(ppu_t *ppu, uint8_t *row);
+static bool can_hit_sprite_zero(ppu_t *ppu);
+static int predict_sprite_zero_hit(ppu_t *ppu);
+static uint16_t read_bg_tile_row(ppu_t *ppu, int tile);
+static uint16_t read_sprite_row(ppu_t *ppu, const sprite_t *sprite);
+static void composite_scanline(ppu_t *ppu, const uint8_t *bg);
+static uint32_t opaque_mask(uint32_t pixels);
+static uint16_t get_bg_color_addr(ppu_t *ppu, int x);
+static void render_sprite_line(ppu_t *ppu);
 static void eval_sprites(ppu_t *ppu);
+static void bucket_sprites(ppu_t *ppu);
 static void set_pixel_color_ix(ppu_t *ppu, int x, int y, uint8_t color_ix);
+static void set_line_dirty(ppu_t *ppu, int y);
 static uint8_t ppu_read8(ppu_t *ppu, uint16_t addr);
 static void ppu_write8(ppu_t *ppu, uint16_t addr, uint8_t val);
 static uint16_t mirror_address(ppu_t *ppu, uint16_t addr);
+static int idle_dots(ppu_t *ppu);
+static int dots_until(ppu_t *ppu, int scanline, int dot);
+static int dots_until_irq(ppu_t *ppu);
+static int dots_until_sprite_zero_hit(ppu_t *ppu);
+static int dots_until_sprite_overflow(ppu_t *ppu);
 
 static unsigned g_palette_addr_map[32] = {
     0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
     0x00, 0x11, 0x12, 0x13, 0x04, 0x15, 0x16, 0x17, 0x08, 0x19, 0x1a, 0x1b, 0x0c, 0x1d, 0x1e, 0x1f,
 };
 
+// sprite_line entries besides the color address bits
+#define SPRITE_LINE_COLOR 0x1f
+#define SPRITE_LINE_BEHIND_BG 0x20
+#define SPRITE_LINE_ZERO 0x40
+
+// sprite_zero_x when sprite 0 doesn't hit on the scanline, and when the CPU
+// changed something after it was predicted
+#define SPRITE_ZERO_NO_HIT AGNES_SCREEN_WIDTH
+#define SPRITE_ZERO_UNKNOWN -1
+
+// 2 bit pixels, leftmost first, of a nibble of the low and the high bit plane
+static uint8_t g_bg_pixels[16][16][4];
+
+#if AGNES_CHR_CACHE
+// The same for a byte of 2 bit chunky pixels
+static uint8_t g_chunky_pixels[256][4];
+#endif
+
+// The bits of a byte spread out to the even bits, to interleave bit planes
+static uint16_t g_plane_bits[256];
+
 void ppu_init(ppu_t *ppu, agnes_t *agnes) {
     memset(ppu, 0, sizeof(ppu_t));
+    memset(ppu->dirty_lines, 0xff, sizeof(ppu->dirty_lines)); // nothing's been shown yet
     ppu->agnes = agnes;
+    ppu->sprite_zero_x = SPRITE_ZERO_UNKNOWN;
 
+    for (int lo = 0; lo < 16; lo++) {
+        for (int hi = 0; hi < 16; hi++) {
+            for (int i = 0; i < 4; i++) {
+                g_bg_pixels[lo][hi][i] = (AGNES_GET_BIT(hi, 3 - i) << 1) | AGNES_GET_BIT(lo, 3 - i);
+            }
+        }
+    }
+    for (int byte = 0; byte < 256; byte++) {
+#if AGNES_CHR_CACHE
+        for (int i = 0; i < 4; i++) {
+            g_chunky_pixels[byte][i] = (byte >> (6 - (i << 1))) & 0x3;
+        }
+#endif
+        g_plane_bits[byte] = 0;
+        for (int i = 0; i < 8; i++) {
+            g_plane_bits[byte] |= AGNES_GET_BIT(byte, i) << (i << 1);
+        }
+    }
+
+    ppu_update_pages(ppu);
     ppu_write_register(ppu, 0x2000, 0);
     ppu_write_register(ppu, 0x2001, 0);
 }
@@ -58,6 +131,9 @@ void ppu_tick(ppu_t *ppu, bool *out_new_frame) {
     }
 
     if (ppu->dot == 0) {
+        if (rendering_enabled && ppu->scanline < 240) {
+            ppu->sprite_zero_x = predict_sprite_zero_hit(ppu);
+        }
         return;
     }
 
@@ -84,6 +160,73 @@ void ppu_tick(ppu_t *ppu, bool *out_new_frame) {
     }
 }
 
+// Runs the PPU for cpu_cycles CPU cycles, stepping over the dots at which
+// nothing can happen (vblank and rendering disabled) in one go. Visible
+// scanlines that are run whole are rendered by render_scanline(): the CPU
+// syncs the PPU before every register, mapper or CHR write, so nothing can
+// change in the middle of them.
+void ppu_run(ppu_t *ppu, int cpu_cycles, bool *out_new_frame) {
+    int dots = cpu_cycles * 3;
+    ppu->sprite_line_valid = false; // the CPU may have changed what it's made from
+    while (dots > 0) {
+        int idle = idle_dots(ppu);
+        if (idle > 0) {
+            if (idle > dots) {
+                idle = dots;
+            }
+            int pos = ppu->scanline * 341 + ppu->dot + idle;
+            ppu->scanline = pos / 341;
+            ppu->dot = pos % 341;
+            dots -= idle;
+        } else if (ppu->dot == 0 && ppu->scanline < 240 && dots >= 340) {
+            render_scanline(ppu); // rendering is enabled, idle_dots() is 0
+            dots -= 340;
+        } else {
+            ppu_tick(ppu, out_new_frame);
+            dots--;
+        }
+    }
+}
+
+// Schedules the next vblank and mapper IRQ from where the PPU is now. Both
+// are due at the end of the CPU cycle whose dots reach them.
+void ppu_schedule_events(ppu_t *ppu, scheduler_t *sched) {
+    scheduler_set(sched, EVENT_VBLANK, (dots_until(ppu, 241, 1) + 2) / 3);
+    int irq_dots = dots_until_irq(ppu);
+    if (irq_dots != INT_MAX) {
+        scheduler_set(sched, EVENT_MAPPER_IRQ, (irq_dots + 2) / 3);
+    } else {
+        scheduler_cancel(sched, EVENT_MAPPER_IRQ);
+    }
+}
+
+// Returns how many whole CPU cycles PPUSTATUS is certain to keep its value for
+int ppu_cycles_until_status_change(ppu_t *ppu) {
+    bool rendering_enabled = ppu->masks.show_background || ppu->masks.show_sprites;
+    int dots = dots_until(ppu, 241, 1); // vblank set
+    int clear_dots = dots_until(ppu, 261, 1); // flags cleared
+    if (clear_dots < dots) {
+        dots = clear_dots;
+    }
+    if (rendering_enabled) {
+        int render_dots = dots_until(ppu, 0, 1);
+        if (render_dots < dots) {
+            dots = render_dots;
+        }
+        if (ppu->scanline < 240) {
+            int hit_dots = dots_until_sprite_zero_hit(ppu);
+            int overflow_dots = dots_until_sprite_overflow(ppu);
+            if (hit_dots < dots) {
+                dots = hit_dots;
+            }
+            if (overflow_dots < dots) {
+                dots = overflow_dots;
+            }
+        }
+    }
+    return (dots - 1) / 3;
+}
+
 static void scanline_visible_pre(ppu_t *ppu, bool *out_new_frame) {
     bool scanline_visible = ppu->scanline >= 0 && ppu->scanline < 240;
     bool scanline_pre = ppu->scanline == 261;
@@ -91,13 +234,14 @@ static void scanline_visible_pre(ppu_t *ppu, bool *out_new_frame) {
     bool dot_fetch = ppu->dot <= 256 || (ppu->dot >= 321 && ppu->dot < 337);
 
     if (scanline_visible && dot_visible) {
-        emit_pixel(ppu);
+        if (ppu->dot - 1 == ppu->sprite_zero_x) {
+            ppu->status.sprite_zero_hit = true;
+        }
+        emit_pixel(ppu, ppu->dot - 1, get_bg_color_addr(ppu, ppu->dot - 1));
     }
 
     if (dot_fetch) {
-        ppu->bg_lo_shift <<= 1;
-        ppu->bg_hi_shift <<= 1;
-        ppu->at_shift = (ppu->at_shift << 2) | (ppu->at_latch & 0x3);
+        shift_bg(ppu);
 
         switch (ppu->dot & 0x7) {
             case 1: {
@@ -130,11 +274,7 @@ static void scanline_visible_pre(ppu_t *ppu, bool *out_new_frame) {
                 break;
             }
             case 0: {
-                ppu->bg_lo_shift = (ppu->bg_lo_shift & 0xff00) | ppu->bg_lo;
-                ppu->bg_hi_shift = (ppu->bg_hi_shift & 0xff00) | ppu->bg_hi;
-
-                ppu->at_latch = ppu->at & 0x3;
-
+                load_bg_tile(ppu);
                 if (ppu->dot == 256) {
                     inc_vert_v(ppu);
                 } else {
@@ -163,17 +303,226 @@ static void scanline_visible_pre(ppu_t *ppu, bool *out_new_frame) {
         ppu->regs.v = (ppu->regs.v & 0x841f) | (ppu->regs.t & ~(0x841f));
     }
 
-    if (ppu->masks.show_background && ppu->masks.show_sprites) {
-        if ((ppu->ctrl.bg_table_addr == 0x0000 && ppu->dot == 270) // Should be 260 but it caused glitches in Kirby
-         || (ppu->ctrl.bg_table_addr == 0x1000 && ppu->dot == 324)) { // Not tested so far.
-            // https://wiki.nesdev.com/w/index.php/MMC3#IRQ_Specifics
-            // PA12 is 12th bit of PPU address bus that's toggled when switching between
-            // background and sprite pattern tables (should happen once per scanline).
-            // This might not work correctly with games using 8x16 sprites
-            // or games writing to CHR RAM.
-            mapper_pa12_rising_edge(ppu->agnes);
+    if ((ppu->ctrl.bg_table_addr == 0x0000 && ppu->dot == 270) // Should be 260 but it caused glitches in Kirby
+     || (ppu->ctrl.bg_table_addr == 0x1000 && ppu->dot == 324)) { // Not tested so far.
+        clock_pa12(ppu);
+    }
+}
+
+// Dots 1 to 340 of a visible scanline with rendering enabled, the same as
+// calling scanline_visible_pre() for each of them. Fetches only depend on v,
+// which only moves every 8 dots, so each tile is fetched in one go and decoded
+// into a row of 4 bit palette indices (0 for transparent). Fine X scrolling is
+// then just an offset into the row.
+static void render_scanline(ppu_t *ppu) {
+    if (ppu->sprite_zero_x == SPRITE_ZERO_UNKNOWN) {
+        ppu->sprite_zero_x = predict_sprite_zero_hit(ppu);
+    }
+    if (ppu->sprite_zero_x != SPRITE_ZERO_NO_HIT) {
+        ppu->status.sprite_zero_hit = true;
+    }
+
+    if (ppu->skip_render) {
+        // The horizontal increments are undone by the copy from t below
+        inc_vert_v(ppu);
+    } else {
+        uint8_t row[34 * 8];
+        fetch_bg_row(ppu, row);
+        composite_scanline(ppu, row + ppu->regs.x);
+    }
+
+    // v: |_...|.F..| |...E|DCBA| = t: |_...|.F..| |...E|DCBA|
+    ppu->regs.v = (ppu->regs.v & 0xfbe0) | (ppu->regs.t & ~(0xfbe0));
+    eval_sprites(ppu);
+
+    // Dots 321-336 prefetch the first two tiles of the next scanline. The PA12
+    // edge (dot 270 or 324) only clocks the mapper's IRQ counter, so it doesn't
+    // matter where it goes in between.
+    clock_pa12(ppu);
+    fetch_bg_tile(ppu);
+    uint8_t first_lo = ppu->bg_lo;
+    uint8_t first_hi = ppu->bg_hi;
+    uint8_t first_at = ppu->at & 0x3;
+    inc_hori_v(ppu);
+    fetch_bg_tile(ppu);
+    inc_hori_v(ppu);
+
+    // Where 16 shifts and the two reloads leave the shift registers
+    ppu->bg_lo_shift = (first_lo << 8) | ppu->bg_lo;
+    ppu->bg_hi_shift = (first_hi << 8) | ppu->bg_hi;
+    ppu->at_shift = first_at * 0x5555;
+    ppu->at_latch = ppu->at & 0x3;
+    ppu->dot = 340;
+}
+
+// Decodes the 34 tiles dots 1-256 shift through, moving v along like their fetches
+static void fetch_bg_row(ppu_t *ppu, uint8_t *row) {
+    // The first two tiles are already in the shift registers. The attributes
+    // of the first one are in at_shift, the second one's is latched.
+    decode_bg_tile(row, ppu->bg_lo_shift >> 8, ppu->bg_hi_shift >> 8, 0);
+    for (int i = 0; i < 8; i++) {
+        if (row[i]) {
+            row[i] |= ((ppu->at_shift >> (14 - (i << 1))) & 0x3) << 2;
         }
     }
+    decode_bg_tile(row + 8, ppu->bg_lo_shift & 0xff, ppu->bg_hi_shift & 0xff, ppu->at_latch & 0x3);
+
+    for (int tile = 0; tile < 32; tile++) {
+#if AGNES_CHR_CACHE
+        // bg_lo and bg_hi are left alone, only the prefetch in render_scanline() sets them
+        uint16_t addr = fetch_bg_nt_at(ppu);
+        uint16_t pixels = chr_cache_get_row(ppu->agnes->chr_cache, ppu->agnes, addr);
+        decode_bg_row(row + 16 + (tile << 3), pixels, ppu->at & 0x3);
+#else
+        fetch_bg_tile(ppu);
+        decode_bg_tile(row + 16 + (tile << 3), ppu->bg_lo, ppu->bg_hi, ppu->at & 0x3);
+#endif
+        if (tile == 31) {
+            inc_vert_v(ppu);
+        } else {
+            inc_hori_v(ppu);
+        }
+    }
+}
+
+// Sprites are selected in OAM order, so sprite 0 can only be the first
+static bool can_hit_sprite_zero(ppu_t *ppu) {
+    return !ppu->status.sprite_zero_hit && ppu->masks.show_background && ppu->masks.show_sprites
+        && ppu->sprite_ixs_count > 0 && ppu->sprite_ixs[0] == 0;
+}
+
+// Works out at dot 0 of a visible scanline at which x sprite 0 is going to hit,
+// from its pattern row and the at most two background tiles under it. That's
+// where emit_pixel() would find the first opaque overlap, as long as the CPU
+// doesn't change anything on the way there. Without it, neither emit_pixel()
+// nor composite_scanline() need to look for hits.
+static int predict_sprite_zero_hit(ppu_t *ppu) {
+    if (!can_hit_sprite_zero(ppu)) {
+        return SPRITE_ZERO_NO_HIT;
+    }
+    const sprite_t *sprite = &ppu->sprites[0];
+    uint16_t pixels = read_sprite_row(ppu, sprite);
+    if (!pixels) {
+        return SPRITE_ZERO_NO_HIT;
+    }
+
+    bool show_leftmost = ppu->masks.show_leftmost_bg && ppu->masks.show_leftmost_sprites;
+    int tile = -1;
+    uint16_t bg_pixels = 0;
+    // Never at x=255
+    for (int s_x = 0; s_x < 8 && sprite->x_pos + s_x < AGNES_SCREEN_WIDTH - 1; s_x++) {
+        int x = sprite->x_pos + s_x;
+        int shift = AGNES_GET_BIT(sprite->attrs, 6) ? s_x << 1 : 14 - (s_x << 1); // flip hor
+        if ((x < 8 && !show_leftmost) || ((pixels >> shift) & 0x3) == 0) {
+            continue;
+        }
+        int bg_x = x + ppu->regs.x; // where fetch_bg_row() would put it
+        if ((bg_x >> 3) != tile) {
+            tile = bg_x >> 3;
+            bg_pixels = read_bg_tile_row(ppu, tile);
+        }
+        if ((bg_pixels >> (14 - ((bg_x & 0x7) << 1))) & 0x3) {
+            return x;
+        }
+    }
+    return SPRITE_ZERO_NO_HIT;
+}
+
+// The pattern row of one of the tiles fetch_bg_row() decodes, without moving v
+static uint16_t read_bg_tile_row(ppu_t *ppu, int tile) {
+    if (tile < 2) {
+        int shift = tile == 0 ? 8 : 0;
+        uint8_t lo = ppu->bg_lo_shift >> shift;
+        uint8_t hi = ppu->bg_hi_shift >> shift;
+        return (g_plane_bits[hi] << 1) | g_plane_bits[lo];
+    }
+
+    // Same as tile - 2 calls to inc_hori_v()
+    uint16_t v = ppu->regs.v;
+    unsigned cx = (v & 0x1f) + tile - 2;
+    if (cx > 31) {
+        v ^= 0x0400;
+    }
+    v = (v & ~0x1f) | (cx & 0x1f);
+    uint8_t nt = ppu_read8(ppu, 0x2000 | (v & 0x0fff));
+    return read_pattern_row(ppu, ppu->ctrl.bg_table_addr + (nt << 4) + ((v >> 12) & 0x7));
+}
+
+static void shift_bg(ppu_t *ppu) {
+    ppu->bg_lo_shift <<= 1;
+    ppu->bg_hi_shift <<= 1;
+    ppu->at_shift = (ppu->at_shift << 2) | (ppu->at_latch & 0x3);
+}
+
+// The nametable, attribute and pattern fetches of the tile at v
+static void fetch_bg_tile(ppu_t *ppu) {
+    uint16_t addr = fetch_bg_nt_at(ppu);
+    ppu->bg_lo = ppu_read8(ppu, addr);
+    ppu->bg_hi = ppu_read8(ppu, addr + 8);
+}
+
+// Just the nametable and attribute fetches, returns the pattern address
+static uint16_t fetch_bg_nt_at(ppu_t *ppu) {
+    uint16_t v = ppu->regs.v;
+    ppu->nt = ppu_read8(ppu, 0x2000 | (v & 0x0fff));
+
+    ppu->at = ppu_read8(ppu, 0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07));
+    if (v & 0x40) {
+        ppu->at = ppu->at >> 4;
+    }
+    if (v & 0x02) {
+        ppu->at = ppu->at >> 2;
+    }
+
+    uint8_t fine_y = (v >> 12) & 0x7;
+    return ppu->ctrl.bg_table_addr + (ppu->nt << 4) + fine_y;
+}
+
+// Writes the 8 palette indices of a tile row: the 2 bit pixel plus palette << 2,
+// or 0 where it's transparent
+static void decode_bg_tile(uint8_t *out, uint8_t lo, uint8_t hi, uint8_t palette) {
+    uint32_t left;
+    uint32_t right;
+    memcpy(&left, g_bg_pixels[lo >> 4][hi >> 4], 4);
+    memcpy(&right, g_bg_pixels[lo & 0xf][hi & 0xf], 4);
+    store_bg_pixels(out, left, right, palette);
+}
+
+#if AGNES_CHR_CACHE
+// The same for a row of chunky pixels from the CHR cache
+static void decode_bg_row(uint8_t *out, uint16_t pixels, uint8_t palette) {
+    uint32_t left;
+    uint32_t right;
+    memcpy(&left, g_chunky_pixels[pixels >> 8], 4);
+    memcpy(&right, g_chunky_pixels[pixels & 0xff], 4);
+    store_bg_pixels(out, left, right, palette);
+}
+#endif
+
+static void store_bg_pixels(uint8_t *out, uint32_t left, uint32_t right, uint8_t palette) {
+    // Every byte is 0-3, so the shift only brings in bits the mask drops
+    uint32_t attr = (uint32_t)palette << 2;
+    left |= ((left | (left >> 1)) & 0x01010101) * attr;
+    right |= ((right | (right >> 1)) & 0x01010101) * attr;
+    memcpy(out, &left, 4);
+    memcpy(out + 4, &right, 4);
+}
+
+static void load_bg_tile(ppu_t *ppu) {
+    ppu->bg_lo_shift = (ppu->bg_lo_shift & 0xff00) | ppu->bg_lo;
+    ppu->bg_hi_shift = (ppu->bg_hi_shift & 0xff00) | ppu->bg_hi;
+    ppu->at_latch = ppu->at & 0x3;
+}
+
+static void clock_pa12(ppu_t *ppu) {
+    if (ppu->masks.show_background && ppu->masks.show_sprites) {
+        // https://wiki.nesdev.com/w/index.php/MMC3#IRQ_Specifics
+        // PA12 is 12th bit of PPU address bus that's toggled when switching between
+        // background and sprite pattern tables (should happen once per scanline).
+        // This might not work correctly with games using 8x16 sprites
+        // or games writing to CHR RAM.
+        mapper_pa12_rising_edge(ppu->agnes);
+    }
 }
 
 #define GET_COARSE_X(v) ((v) & 0x1f)
@@ -219,34 +568,53 @@ static void inc_vert_v(ppu_t *ppu) {
 #undef SET_FINE_Y
 
 static void eval_sprites(ppu_t *ppu) {
-    ppu->sprite_ixs_count = 0;
+    ppu->sprite_line_valid = false;
+    if (!ppu->sprite_buckets_valid) {
+        bucket_sprites(ppu);
+    }
+
+    int count = ppu->sprite_bucket_counts[ppu->scanline];
+    if (count > 8) {
+        ppu->status.sprite_overflow = true;
+        count = 8;
+    }
+    const sprite_t* sprites = (const sprite_t*)ppu->oam_data;
+    for (int i = 0; i < count; i++) {
+        int ix = ppu->sprite_buckets[ppu->scanline][i];
+        ppu->sprites[i] = sprites[ix];
+        ppu->sprite_ixs[i] = ix;
+    }
+    ppu->sprite_ixs_count = count;
+}
+
+// Sorts the sprites in OAM into the scanlines whose eval_sprites() picks them,
+// once after OAM or the sprite height changed instead of checking all 64 of
+// them on every scanline
+static void bucket_sprites(ppu_t *ppu) {
+    memset(ppu->sprite_bucket_counts, 0, sizeof(ppu->sprite_bucket_counts));
+    ppu->sprite_buckets_valid = true;
+
     const sprite_t* sprites = (const sprite_t*)ppu->oam_data;
     int sprite_height = ppu->ctrl.use_8x16_sprites ? 16 : 8;
     for (int i = 0; i < 64; i++) {
         const sprite_t* sprite = &sprites[i];
-
-        if (sprite->y_pos > 0xef || sprite->x_pos > 0xff) {
-            continue;
-        }
-
-        int s_y = ppu->scanline - sprite->y_pos;
-        if (s_y < 0 || s_y >= sprite_height) {
+        if (sprite->y_pos > 0xef) {
             continue;
         }
 
-        if (ppu->sprite_ixs_count < 8) {
-            ppu->sprites[ppu->sprite_ixs_count] = *sprite;
-            ppu->sprite_ixs[ppu->sprite_ixs_count] = i;
-            ppu->sprite_ixs_count++;
-        } else {
-            ppu->status.sprite_overflow = true;
-            break;
+        for (int y = sprite->y_pos; y < sprite->y_pos + sprite_height && y < AGNES_SCREEN_HEIGHT; y++) {
+            uint8_t count = ppu->sprite_bucket_counts[y];
+            if (count < 8) {
+                ppu->sprite_buckets[y][count] = i;
+            }
+            if (count <= 8) { // 9 is enough for the overflow
+                ppu->sprite_bucket_counts[y] = count + 1;
+            }
         }
     }
 }
 
-static void emit_pixel(ppu_t *ppu) {
-    const int x = ppu->dot - 1;
+static void emit_pixel(ppu_t *ppu, int x, uint16_t bg_color_addr) {
     const int y = ppu->scanline;
 
     if (x < 8 && !ppu->masks.show_leftmost_bg && !ppu->masks.show_leftmost_sprites) {
@@ -254,30 +622,83 @@ static void emit_pixel(ppu_t *ppu) {
         return;
     }
 
-    uint16_t bg_color_addr = get_bg_color_addr(ppu);
-
-    int sprite_ix = -1;
-    bool behind_bg = false;
-    uint16_t sp_color_addr = get_sprite_color_addr(ppu, &sprite_ix, &behind_bg);
+    uint8_t sprite = 0;
+    if (ppu->masks.show_sprites && (ppu->masks.show_leftmost_sprites || x >= 8)) {
+        if (!ppu->sprite_line_valid) {
+            render_sprite_line(ppu);
+        }
+        sprite = ppu->sprite_line[x];
+    }
+    uint16_t sp_color_addr = sprite ? 0x3f00 | (sprite & SPRITE_LINE_COLOR) : 0;
 
     uint16_t color_addr = 0x3f00;
     if (bg_color_addr && sp_color_addr) {
-        if (sprite_ix == 0 && x != 255) {
+        // Otherwise scanline_visible_pre() sets it at the predicted dot
+        if ((sprite & SPRITE_LINE_ZERO) && ppu->sprite_zero_x == SPRITE_ZERO_UNKNOWN) {
             ppu->status.sprite_zero_hit = true;
         }
-        color_addr = behind_bg ? bg_color_addr : sp_color_addr;
+        color_addr = (sprite & SPRITE_LINE_BEHIND_BG) ? bg_color_addr : sp_color_addr;
     } else if (bg_color_addr && !sp_color_addr) {
         color_addr = bg_color_addr;
     } else if (!bg_color_addr && sp_color_addr) {
         color_addr = sp_color_addr;
     }
 
-    uint8_t output_color_ix = ppu_read8(ppu, color_addr);
+    uint8_t output_color_ix = ppu->palette[g_palette_addr_map[color_addr & 0x1f]];
     set_pixel_color_ix(ppu, x, y, output_color_ix);
 }
 
-static uint16_t get_bg_color_addr(ppu_t *ppu) {
-    if (!ppu->masks.show_background || (!ppu->masks.show_leftmost_bg && ppu->dot < 9)) {
+// emit_pixel() for a whole scanline, given its background palette indices.
+// The priority logic works on 4 pixels at a time with masks instead of branches.
+static void composite_scanline(ppu_t *ppu, const uint8_t *bg) {
+    // Both are multiples of 4
+    int bg_start = !ppu->masks.show_background ? 256 : !ppu->masks.show_leftmost_bg ? 8 : 0;
+    int sprite_start = !ppu->masks.show_sprites ? 256 : !ppu->masks.show_leftmost_sprites ? 8 : 0;
+    if (sprite_start < 256 && !ppu->sprite_line_valid) {
+        render_sprite_line(ppu);
+    }
+
+    uint8_t colors[AGNES_SCREEN_WIDTH];
+    for (int x = 0; x < AGNES_SCREEN_WIDTH; x += 4) {
+        uint32_t bg_pixels = 0;
+        uint32_t sprite_pixels = 0;
+        if (x >= bg_start) {
+            memcpy(&bg_pixels, bg + x, 4);
+        }
+        if (x >= sprite_start) {
+            memcpy(&sprite_pixels, ppu->sprite_line + x, 4);
+        }
+
+        uint32_t bg_opaque = opaque_mask(bg_pixels);
+        uint32_t behind_bg = opaque_mask(sprite_pixels & (SPRITE_LINE_BEHIND_BG * 0x01010101u));
+        uint32_t use_sprite = opaque_mask(sprite_pixels) & ~(bg_opaque & behind_bg);
+        uint32_t color = (sprite_pixels & (SPRITE_LINE_COLOR * 0x01010101u) & use_sprite) | (bg_pixels & ~use_sprite);
+        memcpy(colors + x, &color, 4);
+    }
+
+    // Palette lookups in place, then only a changed line is written out
+    for (int x = 0; x < AGNES_SCREEN_WIDTH; x++) {
+        colors[x] = ppu->palette[g_palette_addr_map[colors[x]]];
+    }
+    if (!ppu->masks.show_leftmost_bg && !ppu->masks.show_leftmost_sprites) {
+        memset(colors, 63, 8); // 63 is black in my default colour palette
+    }
+    uint8_t *out = &ppu->screen_buffer[ppu->scanline * AGNES_SCREEN_WIDTH];
+    if (memcmp(out, colors, sizeof(colors)) != 0) {
+        memcpy(out, colors, sizeof(colors));
+        set_line_dirty(ppu, ppu->scanline);
+        framebuffer_write_line(&ppu->agnes->framebuffer, ppu->scanline, out);
+    }
+}
+
+// 0xff for every non-zero byte, 0 for the rest
+static uint32_t opaque_mask(uint32_t pixels) {
+    uint32_t high_bits = (((pixels & 0x7f7f7f7fu) + 0x7f7f7f7fu) | pixels) & 0x80808080u;
+    return high_bits | (high_bits - (high_bits >> 7));
+}
+
+static uint16_t get_bg_color_addr(ppu_t *ppu, int x) {
+    if (!ppu->masks.show_background || (!ppu->masks.show_leftmost_bg && x < 8)) {
         return 0;
     }
 
@@ -294,65 +715,62 @@ static uint16_t get_bg_color_addr(ppu_t *ppu) {
     return color_address;
 }
 
-static uint16_t get_sprite_color_addr(ppu_t *ppu, int *out_sprite_ix, bool *out_behind_bg) {
-    *out_sprite_ix = -1;
-    *out_behind_bg = false;
-
-    const int x = ppu->dot - 1;
-    const int y = ppu->scanline;
-
-    if (!ppu->masks.show_sprites || (!ppu->masks.show_leftmost_sprites && x < 8)) {
-        return 0;
-    }
-
-    int sprite_height = ppu->ctrl.use_8x16_sprites ? 16 : 8;
-    uint16_t table = ppu->ctrl.sprite_table_addr;
+// Draws sprites[] on the current scanline into sprite_line: for each pixel
+// the color address bits of the first opaque sprite (0x10 set, so never 0)
+// and whether it's behind the background and sprite 0. The pattern reads
+// happen here once per sprite instead of once per pixel.
+static void render_sprite_line(ppu_t *ppu) {
+    memset(ppu->sprite_line, 0, sizeof(ppu->sprite_line));
+    ppu->sprite_line_valid = true;
 
     for (int i = 0; i < ppu->sprite_ixs_count; i++) {
         const sprite_t *sprite = &ppu->sprites[i];
-        int s_x = x - sprite->x_pos;
-        if (s_x < 0 || s_x >= 8) {
+        uint16_t pixels = read_sprite_row(ppu, sprite);
+        if (!pixels) {
             continue;
         }
 
-        int s_y = y - sprite->y_pos - 1;
-
-        s_x = AGNES_GET_BIT(sprite->attrs, 6) ? 7 - s_x : s_x; // flip hor
-        s_y = AGNES_GET_BIT(sprite->attrs, 7) ? (sprite_height - 1 - s_y) : s_y; // flip vert
-
-        uint8_t tile_num = sprite->tile_num;
-        if (ppu->ctrl.use_8x16_sprites) {
-            table = tile_num & 0x1 ? 0x1000 : 0x0000;
-            tile_num &= 0xfe;
-            if (s_y >= 8) {
-                tile_num += 1;
-                s_y -= 8;
-            }
+        uint8_t attrs = 0x10 | ((sprite->attrs & 0x3) << 2);
+        if (AGNES_GET_BIT(sprite->attrs, 5)) {
+            attrs |= SPRITE_LINE_BEHIND_BG;
+        }
+        if (ppu->sprite_ixs[i] == 0) {
+            attrs |= SPRITE_LINE_ZERO;
         }
 
-        uint16_t offset = table + (tile_num << 4) + s_y;
-
-        uint8_t lo_byte = ppu_read8(ppu, offset);
-        uint8_t hi_byte = ppu_read8(ppu, offset + 8);
-
-        if (!lo_byte && !hi_byte) {
-            continue;
+        for (int s_x = 0; s_x < 8 && sprite->x_pos + s_x < AGNES_SCREEN_WIDTH; s_x++) {
+            uint8_t *out = &ppu->sprite_line[sprite->x_pos + s_x];
+            if (*out) {
+                continue; // an earlier sprite wins
+            }
+            int shift = AGNES_GET_BIT(sprite->attrs, 6) ? s_x << 1 : 14 - (s_x << 1); // flip hor
+            uint8_t palette_ix = (pixels >> shift) & 0x3;
+            if (palette_ix) {
+                *out = attrs | palette_ix;
+            }
         }
+    }
+    ppu->sprite_line[255] &= ~SPRITE_LINE_ZERO; // sprite 0 never hits at x=255
+}
 
-        bool lo_bit = AGNES_GET_BIT(lo_byte, 7 - s_x);
-        bool hi_bit = AGNES_GET_BIT(hi_byte, 7 - s_x);
+// The pattern row of a selected sprite on the current scanline, not flipped
+// horizontally yet
+static uint16_t read_sprite_row(ppu_t *ppu, const sprite_t *sprite) {
+    int sprite_height = ppu->ctrl.use_8x16_sprites ? 16 : 8;
+    int s_y = ppu->scanline - sprite->y_pos - 1;
+    s_y = AGNES_GET_BIT(sprite->attrs, 7) ? (sprite_height - 1 - s_y) : s_y; // flip vert
 
-        if (lo_bit || hi_bit) {
-            *out_sprite_ix = ppu->sprite_ixs[i];
-            if (AGNES_GET_BIT(sprite->attrs, 5)) {
-                *out_behind_bg = true;
-            }
-            uint8_t palette_ix = ((uint8_t)hi_bit << 1) | (uint8_t)lo_bit;
-            uint16_t color_address = 0x3f10 | ((sprite->attrs & 0x3) << 2) | palette_ix;
-            return color_address;
+    uint16_t table = ppu->ctrl.sprite_table_addr;
+    uint8_t tile_num = sprite->tile_num;
+    if (ppu->ctrl.use_8x16_sprites) {
+        table = tile_num & 0x1 ? 0x1000 : 0x0000;
+        tile_num &= 0xfe;
+        if (s_y >= 8) {
+            tile_num += 1;
+            s_y -= 8;
         }
     }
-    return 0;
+    return read_pattern_row(ppu, table + (tile_num << 4) + s_y);
 }
 
 uint8_t ppu_read_register(ppu_t *ppu, uint16_t addr) {
@@ -374,6 +792,7 @@ uint8_t ppu_read_register(ppu_t *ppu, uint16_t addr) {
         }
         case 0x2007: { // PPUDATA
             uint8_t res = 0;
+            ppu->sprite_zero_x = SPRITE_ZERO_UNKNOWN; // v moves
             if (ppu->regs.v < 0x3f00) {
                 res = ppu->ppudata_buffer;
                 ppu->ppudata_buffer = ppu_read8(ppu, ppu->regs.v);
@@ -390,12 +809,17 @@ uint8_t ppu_read_register(ppu_t *ppu, uint16_t addr) {
 
 void ppu_write_register(ppu_t *ppu, uint16_t addr, uint8_t val) {
     ppu->last_reg_write = val;
+    ppu->sprite_zero_x = SPRITE_ZERO_UNKNOWN; // the prediction may not hold anymore
     switch (addr) {
         case 0x2000: { // PPUCTRL
+            bool use_8x16_sprites = AGNES_GET_BIT(val, 5);
+            if (use_8x16_sprites != ppu->ctrl.use_8x16_sprites) {
+                ppu->sprite_buckets_valid = false;
+            }
             ppu->ctrl.addr_increment = AGNES_GET_BIT(val, 2) ? 32 : 1;
             ppu->ctrl.sprite_table_addr = AGNES_GET_BIT(val, 3) ? 0x1000 : 0x0000;
             ppu->ctrl.bg_table_addr = AGNES_GET_BIT(val, 4) ? 0x1000 : 0x0000;
-            ppu->ctrl.use_8x16_sprites = AGNES_GET_BIT(val, 5);
+            ppu->ctrl.use_8x16_sprites = use_8x16_sprites;
             ppu->ctrl.nmi_enabled = AGNES_GET_BIT(val, 7);
 
             //    t: |_...|BA..| |....|....| = d: |....|..BA|
@@ -416,6 +840,7 @@ void ppu_write_register(ppu_t *ppu, uint16_t addr, uint8_t val) {
         case 0x2004: { // OAMDATA
             ppu->oam_data[ppu->oam_address] = val;
             ppu->oam_address++;
+            ppu->sprite_buckets_valid = false;
             break;
         }
         case 0x2005: { // SCROLL
@@ -459,36 +884,66 @@ void ppu_write_register(ppu_t *ppu, uint16_t addr, uint8_t val) {
             break;
         }
         case 0x4014: { // OAMDMA
-            uint16_t dma_addr = ((uint16_t)val) << 8;
-            for (int i = 0; i < 256; i++) {
-                ppu->oam_data[ppu->oam_address] = cpu_read8(&ppu->agnes->cpu, dma_addr);
-                ppu->oam_address++;
-                dma_addr++;
+            cpu_t *cpu = &ppu->agnes->cpu;
+            const uint8_t *page = cpu->read_pages[val];
+            if (page) {
+                // RAM, PRG RAM or ROM: copy in two runs around the OAM address
+                unsigned first = 256 - ppu->oam_address;
+                memcpy(ppu->oam_data + ppu->oam_address, page, first);
+                memcpy(ppu->oam_data, page + first, 256 - first);
+            } else {
+                uint16_t dma_addr = ((uint16_t)val) << 8;
+                for (int i = 0; i < 256; i++) {
+                    ppu->oam_data[ppu->oam_address] = cpu_read8(cpu, dma_addr);
+                    ppu->oam_address++;
+                    dma_addr++;
+                }
             }
-            cpu_set_dma_stall(&ppu->agnes->cpu);
+            ppu->sprite_buckets_valid = false;
+            // The stall is run in one go by instruction_run(), see EVENT_DMA_END
+            cpu_set_dma_stall(cpu);
             break;
         }
     }
 }
 
 static void set_pixel_color_ix(ppu_t *ppu, int x, int y, uint8_t color_ix) {
-    int ix = (y * AGNES_SCREEN_WIDTH) + x;
-    ppu->screen_buffer[ix] = color_ix;
+    if (ppu->skip_render) {
+        return;
+    }
+    // Rendering can start or stop anywhere in a line drawn dot by dot
+    uint8_t *pixel = &ppu->screen_buffer[y * AGNES_SCREEN_WIDTH + x];
+    if (*pixel != color_ix) {
+        *pixel = color_ix;
+        set_line_dirty(ppu, y);
+        framebuffer_write_pixel(&ppu->agnes->framebuffer, x, y, color_ix);
+    }
+}
+
+static void set_line_dirty(ppu_t *ppu, int y) {
+    ppu->dirty_lines[y >> 3] |= 1 << (y & 0x7);
+}
+
+// The pattern row whose low plane is at addr as 2 bit chunky pixels, leftmost
+// in the top bits
+static uint16_t read_pattern_row(ppu_t *ppu, uint16_t addr) {
+#if AGNES_CHR_CACHE
+    if (addr < 0x2000 && (addr & 0x8) == 0) { // not for the odd addresses a flipped 8x16 sprite can give
+        return chr_cache_get_row(ppu->agnes->chr_cache, ppu->agnes, addr);
+    }
+#endif
+    uint8_t lo = ppu_read8(ppu, addr);
+    uint8_t hi = ppu_read8(ppu, addr + 8);
+    return (g_plane_bits[hi] << 1) | g_plane_bits[lo];
 }
 
 static uint8_t ppu_read8(ppu_t *ppu, uint16_t addr) {
     addr = addr & 0x3fff;
-    uint8_t res = 0;
-    if (addr >= 0x3f00) { // $3F00 - $3FFF, palette reads are most common
+    if (addr >= 0x3f00) { // $3F00 - $3FFF
         unsigned palette_ix = g_palette_addr_map[addr & 0x1f];
-        res = ppu->palette[palette_ix];
-    } else if (addr < 0x2000) { // $0000 - $1FFF
-        res = mapper_read(ppu->agnes, addr);
-    } else { // $2000 - $3EFF
-        uint16_t mirrored_addr = mirror_address(ppu, addr);
-        res = ppu->nametables[mirrored_addr];
+        return ppu->palette[palette_ix];
     }
-    return res;
+    return ppu->pages[addr >> 10][addr & 0x3ff];
 }
 
 static void ppu_write8(ppu_t *ppu, uint16_t addr, uint8_t val) {
@@ -504,6 +959,28 @@ static void ppu_write8(ppu_t *ppu, uint16_t addr, uint8_t val) {
     }
 }
 
+// Maps size bytes (a multiple of 1KB) of pattern memory starting at addr for
+// reads, writes still go through the mapper
+void ppu_map_memory(ppu_t *ppu, uint16_t addr, unsigned size, const uint8_t *data) {
+    unsigned first_page = addr >> 10;
+    unsigned pages_count = size >> 10;
+    for (unsigned i = 0; i < pages_count; i++) {
+        ppu->pages[first_page + i] = data + (i << 10);
+    }
+    ppu->sprite_zero_x = SPRITE_ZERO_UNKNOWN;
+}
+
+// Maps the nametables for the mirroring mode, $3000 - $3EFF mirrors $2000 -
+// $2EFF, and has the mapper map the pattern tables. Mappers call it when they
+// change the mirroring mode.
+void ppu_update_pages(ppu_t *ppu) {
+    for (unsigned i = 0; i < 8; i++) {
+        uint16_t addr = 0x2000 | ((i & 0x3) << 10);
+        ppu->pages[8 + i] = &ppu->nametables[mirror_address(ppu, addr)];
+    }
+    mapper_update_chr_pages(ppu->agnes);
+}
+
 static uint16_t mirror_address(ppu_t *ppu, uint16_t addr) {
     switch (ppu->agnes->mirroring_mode)
     {
@@ -515,3 +992,115 @@ static uint16_t mirror_address(ppu_t *ppu, uint16_t addr) {
         default: return 0;
     }
 }
+
+// Number of upcoming dots ppu_tick() would only count
+static int idle_dots(ppu_t *ppu) {
+    bool rendering_enabled = ppu->masks.show_background || ppu->masks.show_sprites;
+    int pos = ppu->scanline * 341 + ppu->dot;
+    int next; // next dot that has to be ticked
+    if (rendering_enabled) {
+        if (ppu->scanline < 240 || ppu->scanline == 261) {
+            return 0;
+        }
+        next = (pos < 241 * 341 + 1) ? (241 * 341 + 1) : (261 * 341 + 1);
+    } else if (pos < 241 * 341 + 1) {
+        next = 241 * 341 + 1;
+    } else if (pos < 261 * 341 + 1) {
+        next = 261 * 341 + 1;
+    } else {
+        next = 262 * 341; // end of frame
+    }
+    return next - pos - 1;
+}
+
+// Number of ppu_tick() calls until scanline and dot are reached, at most
+// one frame ahead
+static int dots_until(ppu_t *ppu, int scanline, int dot) {
+    int pos = ppu->scanline * 341 + ppu->dot;
+    int dots = (scanline * 341 + dot) - pos;
+    if (dots <= 0) {
+        dots += 262 * 341;
+        bool rendering_enabled = ppu->masks.show_background || ppu->masks.show_sprites;
+        if (rendering_enabled && ppu->is_odd_frame && pos <= 261 * 341 + 339) {
+            dots--; // skipped dot at the end of odd frames
+        }
+    }
+    return dots;
+}
+
+// Number of ppu_tick() calls until the PA12 rising edge that makes the mapper
+// trigger an IRQ, INT_MAX if that's not going to happen within a frame
+static int dots_until_irq(ppu_t *ppu) {
+    unsigned edges = mapper_edges_until_irq(ppu->agnes);
+    if (edges == 0 || !ppu->masks.show_background || !ppu->masks.show_sprites) {
+        return INT_MAX;
+    }
+    // Same dots as in scanline_visible_pre()
+    int edge_dot = ppu->ctrl.bg_table_addr == 0x0000 ? 270 : 324;
+    int scanline = ppu->scanline;
+    if (ppu->dot >= edge_dot) {
+        scanline = (scanline + 1) % 262;
+    }
+    for (int i = 0; i < 262; i++) {
+        if (scanline < 240 || scanline == 261) {
+            edges--;
+            if (edges == 0) {
+                return dots_until(ppu, scanline, edge_dot);
+            }
+        }
+        scanline = (scanline + 1) % 262;
+    }
+    return INT_MAX;
+}
+
+// Number of ppu_tick() calls until sprite 0 can hit, at the earliest. That's
+// the predicted dot on the current scanline, and the first dot sprite 0 covers
+// on the later ones.
+static int dots_until_sprite_zero_hit(ppu_t *ppu) {
+    if (ppu->status.sprite_zero_hit || !ppu->masks.show_background || !ppu->masks.show_sprites) {
+        return INT_MAX;
+    }
+    if (ppu->dot <= 256) {
+        if (ppu->sprite_zero_x == SPRITE_ZERO_UNKNOWN) {
+            return 0;
+        }
+        if (ppu->sprite_zero_x != SPRITE_ZERO_NO_HIT) {
+            return dots_until(ppu, ppu->scanline, ppu->sprite_zero_x + 1);
+        }
+    }
+
+    int scanline = ppu->scanline + 1;
+    if (ppu->dot > 256) {
+        // The sprites of the next scanline have been copied out of OAM already
+        if (ppu->sprite_ixs_count > 0 && ppu->sprite_ixs[0] == 0) {
+            return dots_until(ppu, scanline, ppu->sprites[0].x_pos + 1);
+        }
+        scanline++;
+    }
+    const sprite_t *sprite = (const sprite_t*)ppu->oam_data;
+    int sprite_height = ppu->ctrl.use_8x16_sprites ? 16 : 8;
+    if (scanline <= sprite->y_pos) {
+        scanline = sprite->y_pos + 1;
+    }
+    if (sprite->y_pos > 0xef || scanline > sprite->y_pos + sprite_height || scanline >= 240) {
+        return INT_MAX;
+    }
+    return dots_until(ppu, scanline, sprite->x_pos + 1);
+}
+
+// Number of ppu_tick() calls until eval_sprites() sets the sprite overflow,
+// at dot 257 of the next visible scanline with more than 8 sprites
+static int dots_until_sprite_overflow(ppu_t *ppu) {
+    if (ppu->status.sprite_overflow) {
+        return INT_MAX;
+    }
+    if (!ppu->sprite_buckets_valid) {
+        bucket_sprites(ppu);
+    }
+    for (int y = ppu->dot < 257 ? ppu->scanline : ppu->scanline + 1; y < AGNES_SCREEN_HEIGHT; y++) {
+        if (ppu->sprite_bucket_counts[y] > 8) {
+            return dots_until(ppu, y, 257);
+        }
+    }
+    return INT_MAX;
+}
@@ -7,10 +7,16 @@
 
 typedef struct agnes agnes_t;
 typedef struct ppu ppu_t;
+typedef struct scheduler scheduler_t;
 
 AGNES_INTERNAL void ppu_init(ppu_t *ppu, agnes_t *agnes);
 AGNES_INTERNAL void ppu_tick(ppu_t *ppu, bool *out_new_frame);
+AGNES_INTERNAL void ppu_run(ppu_t *ppu, int cpu_cycles, bool *out_new_frame);
+AGNES_INTERNAL void ppu_schedule_events(ppu_t *ppu, scheduler_t *sched);
+AGNES_INTERNAL int ppu_cycles_until_status_change(ppu_t *ppu);
 AGNES_INTERNAL uint8_t ppu_read_register(ppu_t *ppu, uint16_t reg);
 AGNES_INTERNAL void ppu_write_register(ppu_t *ppu, uint16_t addr, uint8_t val);
+AGNES_INTERNAL void ppu_map_memory(ppu_t *ppu, uint16_t addr, unsigned size, const uint8_t *data);
+AGNES_INTERNAL void ppu_update_pages(ppu_t *ppu);
 
 #endif /* ppu_h */
@@ -0,0 +1,48 @@
+#include <limits.h>
+
+#ifndef AGNES_SINGLE_HEADER
+#include "scheduler.h"
+
+#include "agnes_types.h"
+#endif
+
+void scheduler_reset(scheduler_t *sched) {
+    sched->now = 0;
+    sched->pending = 0;
+}
+
+// Moves the master clock forward to the current sync point
+void scheduler_advance(scheduler_t *sched, int cycles) {
+    sched->now += cycles;
+}
+
+// Sets event to be due cycles after the current sync point, replacing any
+// earlier due time
+void scheduler_set(scheduler_t *sched, event_t event, int cycles) {
+    sched->due[event] = sched->now + cycles;
+    sched->pending |= 1 << event;
+}
+
+void scheduler_cancel(scheduler_t *sched, event_t event) {
+    sched->pending &= ~(1 << event);
+}
+
+bool scheduler_is_pending(const scheduler_t *sched, event_t event) {
+    return sched->pending & (1 << event);
+}
+
+// Returns the cycles from the current sync point to the earliest pending
+// event, INT_MAX with nothing pending. Due times are compared as distances
+// from now, so the master clock can wrap around.
+int scheduler_cycles_until_next(const scheduler_t *sched) {
+    uint32_t min_cycles = INT_MAX;
+    for (int i = 0; i < EVENT_COUNT; i++) {
+        if (sched->pending & (1 << i)) {
+            uint32_t cycles = sched->due[i] - sched->now;
+            if (cycles < min_cycles) {
+                min_cycles = cycles;
+            }
+        }
+    }
+    return (int)min_cycles;
+}
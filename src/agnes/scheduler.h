@@ -0,0 +1,25 @@
+#ifndef scheduler_h
+#define scheduler_h
+
+#ifndef AGNES_SINGLE_HEADER
+#include "common.h"
+#endif
+
+typedef enum {
+    EVENT_VBLANK = 0, // PPU reaches 241,1: new frame and NMI
+    EVENT_MAPPER_IRQ,
+    EVENT_DMA_END, // OAM DMA stops stalling the CPU
+    EVENT_RUN_END, // instruction_run() is out of cycles
+    EVENT_COUNT
+} event_t;
+
+typedef struct scheduler scheduler_t;
+
+AGNES_INTERNAL void scheduler_reset(scheduler_t *sched);
+AGNES_INTERNAL void scheduler_advance(scheduler_t *sched, int cycles);
+AGNES_INTERNAL void scheduler_set(scheduler_t *sched, event_t event, int cycles);
+AGNES_INTERNAL void scheduler_cancel(scheduler_t *sched, event_t event);
+AGNES_INTERNAL bool scheduler_is_pending(const scheduler_t *sched, event_t event);
+AGNES_INTERNAL int scheduler_cycles_until_next(const scheduler_t *sched);
+
+#endif /* scheduler_h */
@@ -12,6 +12,9 @@
 #define WINDOW_WIDTH 320
 #define WINDOW_HEIGHT 240
 
+// Frames run without drawing them between each one that's shown
+#define SKIPPED_FRAMES 1
+
 static void get_input(agnes_input_t *out_input);
 
 int main(void) {
@@ -54,7 +57,12 @@ int main(void) {
         gfx_palette[i] = gfx_RGBTo1555(g_colors[i].r, g_colors[i].g, g_colors[i].b);
     }
 
+    // agnes writes changed lines straight into the draw buffer
+    agnes_set_framebuffer(agnes, &gfx_vbuffer[0][x_offset], WINDOW_WIDTH, AGNES_PIXEL_FORMAT_INDEXED8, 0);
+    gfx_BlitBuffer(); // the borders and the first screen, only dirty lines after this
+
     agnes_input_t input;
+    uint8_t dirty_lines[AGNES_SCREEN_HEIGHT / 8];
     kb_Scan();
     while (!(kb_Data[6] & kb_Clear)) {
         dbg_sprintf(dbgout, "Processing input\n");
@@ -63,7 +71,12 @@ int main(void) {
         agnes_set_input(agnes, &input, NULL);
 
         dbg_sprintf(dbgout, "Processing frame\n");
-        ok = agnes_next_frame(agnes);
+        for (int i = 0; ok && i < SKIPPED_FRAMES; i++) {
+            ok = agnes_next_frame_skip(agnes);
+        }
+        if (ok) {
+            ok = agnes_next_frame(agnes);
+        }
         kb_Scan();
         if (!ok) {
             ti_Close(fp);
@@ -71,15 +84,13 @@ int main(void) {
         }
 
         dbg_sprintf(dbgout, "Writing to screen\n");
-        for (int x = 0; x < AGNES_SCREEN_WIDTH; x++) {
-            for(int y = 0; y < AGNES_SCREEN_HEIGHT; y++) {
-                int ix = agnes_get_screen_index(agnes, x, y);
-
-                gfx_SetColor(ix);
-                gfx_SetPixel(x + x_offset, y);
+        if (agnes_get_dirty_lines(agnes, dirty_lines)) {
+            for (int y = 0; y < AGNES_SCREEN_HEIGHT; y++) {
+                if (dirty_lines[y >> 3] & (1 << (y & 0x7))) {
+                    gfx_BlitLines(gfx_buffer, y, 1);
+                }
             }
         }
-        gfx_BlitBuffer();
     }
     agnes_destroy(agnes);
     ti_Close(fp);